@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bptree.h"
+
+#define BP_TREE_SPLIT (BP_TREE_ORDER / 2)
+
+
+static bp_node_t* bp_node_new(bp_tree_t *t, int leaf) {
+    bp_node_t *node;
+    if (posix_memalign((void **)&node, BP_TREE_ALIGN, sizeof(bp_node_t)) != 0)
+        return NULL;
+    node->n = 0;
+    node->leaf = leaf;
+    if (leaf)
+        node->u.l.prev = node->u.l.next = NULL;
+    t->nodes++;
+    return node;
+}
+
+static void bp_node_free(bp_tree_t *t, bp_node_t *node) {
+    t->nodes--;
+    free(node);
+}
+
+// 内部节点中 key 应进入的子节点下标：keys[i-1] <= key < keys[i]
+// 不提前退出，编译器可以展开成无分支的比较累加
+static inline unsigned bp_child_index(bp_node_t *node, uint64_t key) {
+    unsigned i, idx = 0;
+    for (i = 0; i < node->n; i++)
+        idx += node->keys[i] <= key;
+    return idx;
+}
+
+// 叶子节点中第一个 >= key 的位置
+static inline unsigned bp_leaf_index(bp_node_t *node, uint64_t key) {
+    unsigned i, idx = 0;
+    for (i = 0; i < node->n; i++)
+        idx += node->keys[i] < key;
+    return idx;
+}
+
+void bp_tree_init(bp_tree_t *t) {
+    t->root = NULL;
+    t->head = NULL;
+    t->count = 0;
+    t->nodes = 0;
+}
+
+static void bp_node_destroy(bp_tree_t *t, bp_node_t *node) {
+    unsigned i;
+    if (!node->leaf)
+        for (i = 0; i <= node->n; i++)
+            bp_node_destroy(t, node->u.child[i]);
+    bp_node_free(t, node);
+}
+
+void bp_tree_destroy(bp_tree_t *t) {
+    if (t->root)
+        bp_node_destroy(t, t->root);
+    bp_tree_init(t);
+}
+
+/*
+ * 拆分 parent 的第 i 个子节点（必须已满），右半部分挂到 child[i+1]
+ *   叶子：左右各 BP_TREE_SPLIT 个，右半部分的最小 key 复制到 parent 作为分隔
+ *   内部节点：左边 BP_TREE_SPLIT 个，中间一个上移到 parent，其余放右边
+ */
+static int bp_split_child(bp_tree_t *t, bp_node_t *parent, unsigned i) {
+    bp_node_t *node = parent->u.child[i], *right;
+    uint64_t up_key;
+
+    right = bp_node_new(t, node->leaf);
+    if (right == NULL)
+        return -1;
+
+    if (node->leaf) {
+        right->n = node->n - BP_TREE_SPLIT;
+        memcpy(right->keys, &node->keys[BP_TREE_SPLIT], right->n * sizeof(uint64_t));
+        memcpy(right->u.l.vals, &node->u.l.vals[BP_TREE_SPLIT], right->n * sizeof(void *));
+        up_key = right->keys[0];
+
+        right->u.l.prev = node;
+        right->u.l.next = node->u.l.next;
+        if (node->u.l.next)
+            node->u.l.next->u.l.prev = right;
+        node->u.l.next = right;
+    } else {
+        right->n = node->n - BP_TREE_SPLIT - 1;
+        memcpy(right->keys, &node->keys[BP_TREE_SPLIT + 1], right->n * sizeof(uint64_t));
+        memcpy(right->u.child, &node->u.child[BP_TREE_SPLIT + 1], (right->n + 1) * sizeof(bp_node_t *));
+        up_key = node->keys[BP_TREE_SPLIT];
+    }
+    node->n = BP_TREE_SPLIT;
+
+    memmove(&parent->keys[i + 1], &parent->keys[i], (parent->n - i) * sizeof(uint64_t));
+    memmove(&parent->u.child[i + 2], &parent->u.child[i + 1], (parent->n - i) * sizeof(bp_node_t *));
+    parent->keys[i] = up_key;
+    parent->u.child[i + 1] = right;
+    parent->n++;
+    return 0;
+}
+
+/*
+ * 自顶向下插入：下降途中遇到已满的子节点先拆分，保证父节点总有空位
+ * 每次拆分只分配一个节点，分配失败时树仍然完整，只是本次插入失败
+ */
+int bp_tree_insert(bp_tree_t *t, uint64_t key, void *val) {
+    bp_node_t *node, *root;
+    unsigned pos;
+
+    if (t->root == NULL) {
+        t->root = t->head = bp_node_new(t, 1);
+        if (t->root == NULL)
+            return -1;
+    }
+
+    if (t->root->n == BP_TREE_ORDER) {  // 根节点已满，树高加一
+        root = bp_node_new(t, 0);
+        if (root == NULL)
+            return -1;
+        root->u.child[0] = t->root;
+        if (bp_split_child(t, root, 0) != 0) {
+            bp_node_free(t, root);
+            return -1;
+        }
+        t->root = root;
+    }
+
+    node = t->root;
+    while (!node->leaf) {
+        pos = bp_child_index(node, key);
+        if (node->u.child[pos]->n == BP_TREE_ORDER) {
+            if (bp_split_child(t, node, pos) != 0)
+                return -1;
+            pos += key >= node->keys[pos];
+        }
+        node = node->u.child[pos];
+    }
+
+    pos = bp_leaf_index(node, key);
+    memmove(&node->keys[pos + 1], &node->keys[pos], (node->n - pos) * sizeof(uint64_t));
+    memmove(&node->u.l.vals[pos + 1], &node->u.l.vals[pos], (node->n - pos) * sizeof(void *));
+    node->keys[pos] = key;
+    node->u.l.vals[pos] = val;
+    node->n++;
+    t->count++;
+    return 0;
+}
+
+static void bp_leaf_unlink(bp_tree_t *t, bp_node_t *leaf) {
+    if (leaf->u.l.prev)
+        leaf->u.l.prev->u.l.next = leaf->u.l.next;
+    else
+        t->head = leaf->u.l.next;
+    if (leaf->u.l.next)
+        leaf->u.l.next->u.l.prev = leaf->u.l.prev;
+}
+
+// 从内部节点摘除第 i 个子节点及其对应的分隔 key，返回 1 表示 node 已没有子节点
+static int bp_remove_child(bp_tree_t *t, bp_node_t *node, unsigned i) {
+    unsigned k;
+    bp_node_free(t, node->u.child[i]);
+    if (node->n == 0)
+        return 1;
+    // child[i] 的左边界是 keys[i-1]；摘除 child[0] 时由 child[1] 接管其范围，去掉 keys[0]
+    k = i > 0 ? i - 1 : 0;
+    memmove(&node->keys[k], &node->keys[k + 1], (node->n - k - 1) * sizeof(uint64_t));
+    memmove(&node->u.child[i], &node->u.child[i + 1], (node->n - i) * sizeof(bp_node_t *));
+    node->n--;
+    return 0;
+}
+
+// 返回 1 表示 node 已空，需要由上层释放
+static int bp_delete_rec(bp_tree_t *t, bp_node_t *node, uint64_t key, void **val) {
+    unsigned pos;
+
+    if (node->leaf) {
+        pos = bp_leaf_index(node, key);
+        if (pos == node->n || node->keys[pos] != key)
+            return 0;
+        *val = node->u.l.vals[pos];
+        t->count--;
+        memmove(&node->keys[pos], &node->keys[pos + 1], (node->n - pos - 1) * sizeof(uint64_t));
+        memmove(&node->u.l.vals[pos], &node->u.l.vals[pos + 1], (node->n - pos - 1) * sizeof(void *));
+        if (--node->n > 0)
+            return 0;
+        bp_leaf_unlink(t, node);
+        return 1;
+    }
+
+    pos = bp_child_index(node, key);
+    if (!bp_delete_rec(t, node->u.child[pos], key, val))
+        return 0;
+    return bp_remove_child(t, node, pos);
+}
+
+// 根节点只剩一个子节点时降低树高
+static void bp_tree_shrink(bp_tree_t *t, int empty) {
+    bp_node_t *root;
+    if (empty) {
+        bp_node_free(t, t->root);
+        t->root = t->head = NULL;
+        return;
+    }
+    while (!t->root->leaf && t->root->n == 0) {
+        root = t->root;
+        t->root = root->u.child[0];
+        bp_node_free(t, root);
+    }
+}
+
+void* bp_tree_delete(bp_tree_t *t, uint64_t key) {
+    void *val = NULL;
+    int empty;
+
+    if (t->root == NULL)
+        return NULL;
+    empty = bp_delete_rec(t, t->root, key, &val);
+    bp_tree_shrink(t, empty);
+    return val;
+}
+
+void* bp_tree_find(bp_tree_t *t, uint64_t key) {
+    bp_node_t *node = t->root;
+    unsigned pos;
+
+    if (node == NULL)
+        return NULL;
+    while (!node->leaf)
+        node = node->u.child[bp_child_index(node, key)];
+    pos = bp_leaf_index(node, key);
+    return pos < node->n && node->keys[pos] == key ? node->u.l.vals[pos] : NULL;
+}
+
+// 最左叶子已空，沿 child[0] 向下找到它并从树中摘除
+static int bp_remove_head_rec(bp_tree_t *t, bp_node_t *node) {
+    if (node->leaf) {
+        bp_leaf_unlink(t, node);
+        return 1;
+    }
+    if (!bp_remove_head_rec(t, node->u.child[0]))
+        return 0;
+    return bp_remove_child(t, node, 0);
+}
+
+/*
+ * 按 key 从小到大摘下最多 max 个 key <= 给定 key 的值，写入 out，返回个数
+ * 只访问 head 开始的叶子链表，一个叶子整段摘完后才回到树上摘除该叶子
+ */
+unsigned bp_tree_pop_le(bp_tree_t *t, uint64_t key, void **out, unsigned max) {
+    bp_node_t *leaf;
+    unsigned cnt = 0, j;
+
+    while ((leaf = t->head) != NULL && cnt < max) {
+        for (j = 0; j < leaf->n && leaf->keys[j] <= key && cnt < max; j++)
+            out[cnt++] = leaf->u.l.vals[j];
+        if (j == 0)
+            break;
+        t->count -= j;
+        if (j < leaf->n) {
+            leaf->n -= j;
+            memmove(leaf->keys, &leaf->keys[j], leaf->n * sizeof(uint64_t));
+            memmove(leaf->u.l.vals, &leaf->u.l.vals[j], leaf->n * sizeof(void *));
+            break;
+        }
+        leaf->n = 0;
+        bp_tree_shrink(t, bp_remove_head_rec(t, t->root));
+    }
+    return cnt;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rbtree.h"
+#include "bptree.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t rnd_state = 2463534242u;
+static uint32_t rnd() {  // xorshift32
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/*
+ * 模拟定时器的完整生命周期：插入 n 个定时器，随机取消 10%，再按时间推进全部到期
+ *   每毫秒添加约 100 个定时器，random_pct% 的超时时间为 0~30s 内随机，其余固定为 30s
+ *   红黑树使用 ngx_rbtree_detach_le 摘下到期节点，B+ 树使用 bp_tree_pop_le
+ */
+static uint32_t *keys;
+static char *cancelled;
+
+static void gen(unsigned n, int random_pct) {
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        uint32_t now = i / 100;
+        keys[i] = (int)(rnd() % 100) < random_pct ? now + rnd() % 30000 : now + 30000;
+        cancelled[i] = rnd() % 10 == 0;
+    }
+}
+
+static void report(const char *name, const char *tree, unsigned n, uint64_t t0, uint64_t t1,
+    uint64_t t2, uint64_t t3, double bytes) {
+    printf("%-7s %-6s n=%-9u insert=%6.1fns cancel=%6.1fns expire=%6.1fns  %.1f B/timer\n",
+        name, tree, n, (double)(t1 - t0) / n, (double)(t2 - t1) / (n / 10), (double)(t3 - t2) / n, bytes);
+}
+
+static void bench_rbtree(const char *name, unsigned n) {
+    ngx_rbtree_t tree;
+    ngx_rbtree_node_t sentinel, *node;
+    ngx_rbtree_node_t *nodes = (ngx_rbtree_node_t *)calloc(n, sizeof(*nodes));
+    uint32_t now, end = n / 100 + 30001;
+    unsigned i, expired = 0;
+    uint64_t t0, t1, t2, t3;
+
+    ngx_rbtree_init(&tree, &sentinel, ngx_rbtree_insert_value);
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        nodes[i].key = keys[i];
+        ngx_rbtree_insert(&tree, &nodes[i]);
+    }
+    t1 = now_ns();
+    for (i = 0; i < n; i++)
+        if (cancelled[i])
+            ngx_rbtree_delete(&tree, &nodes[i]);
+    t2 = now_ns();
+    for (now = 0; now <= end; now++)
+        for (node = ngx_rbtree_detach_le(&tree, now); node; node = node->right)
+            expired++;
+    t3 = now_ns();
+
+    report(name, "rbtree", n, t0, t1, t2, t3, (double)sizeof(ngx_rbtree_node_t));
+    if (ngx_rbtree_leftmost(&tree) != NULL || expired == 0)
+        printf("rbtree: unexpected state\n");
+    free(nodes);
+}
+
+static void bench_bptree(const char *name, unsigned n) {
+    bp_tree_t tree;
+    void *out[64];
+    uint32_t now, end = n / 100 + 30001;
+    unsigned i, k, expired = 0;
+    uint64_t t0, t1, t2, t3;
+    double bytes;
+
+    bp_tree_init(&tree);
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        bp_tree_insert(&tree, (uint64_t)keys[i] << 32 | i, &keys[i]);
+    t1 = now_ns();
+    bytes = (double)tree.nodes * sizeof(bp_node_t) / n;
+    for (i = 0; i < n; i++)
+        if (cancelled[i])
+            bp_tree_delete(&tree, (uint64_t)keys[i] << 32 | i);
+    t2 = now_ns();
+    for (now = 0; now <= end; now++)
+        while ((k = bp_tree_pop_le(&tree, (uint64_t)now << 32 | 0xffffffff, out, 64)) > 0)
+            expired += k;
+    t3 = now_ns();
+
+    report(name, "bptree", n, t0, t1, t2, t3, bytes);
+    if (!bp_tree_empty(&tree) || expired == 0)
+        printf("bptree: unexpected state\n");
+    bp_tree_destroy(&tree);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned sizes[] = {10000, 1000000, 10000000};
+    unsigned i, cnt = 3;
+
+    if (argc > 1) {  // 只测指定的规模
+        sizes[0] = (unsigned)atoi(argv[1]);
+        cnt = 1;
+    }
+    for (i = 0; i < cnt; i++) {
+        keys = (uint32_t *)malloc(sizes[i] * sizeof(uint32_t));
+        cancelled = (char *)malloc(sizes[i]);
+
+        gen(sizes[i], 10);
+        bench_rbtree("mixed", sizes[i]);
+        bench_bptree("mixed", sizes[i]);
+        gen(sizes[i], 100);
+        bench_rbtree("random", sizes[i]);
+        bench_bptree("random", sizes[i]);
+
+        free(keys);
+        free(cancelled);
+    }
+    return 0;
+}
+
+// gcc -O2 bptree_bench.c bptree.c rbtree.c -o bpt_bench
@@ -0,0 +1,225 @@
+#ifndef _MARK_BPT_
+#define _MARK_BPT_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#if defined(__APPLE__)
+#include <AvailabilityMacros.h>
+#include <sys/time.h>
+#include <mach/task.h>
+#include <mach/mach.h>
+#else
+#include <time.h>
+#endif
+
+#include "bptree.h"
+#include "mempool.h"
+
+/*
+ * 与 rbtree_tmier.h 接口相同的定时器，底层换成 bptree.h 的 B+ 树
+ *   B+ 树的 key 必须唯一：高 32 位为超时时间，低 32 位为递增序号，
+ *   同一毫秒内的定时器按添加顺序到期
+ */
+
+#ifdef TIMER_USE_POOL
+static mem_pool_t        *entry_pool;  // 所有实例共享
+#endif
+
+#define TIMER_FIXED_RATE  0 // 固定频率：下次超时时间 = 本次超时时间 + 间隔，不会累积漂移
+#define TIMER_FIXED_DELAY 1 // 固定延迟：下次超时时间 = 回调返回时的时间 + 间隔
+
+#define TIMER_EXPIRE_BATCH 64 // expire_timer 每次从树上摘下的定时器个数
+
+typedef struct timer_entry_s timer_entry_t;
+typedef void (*timer_handler_pt)(timer_entry_t *ev);
+
+struct timer_entry_s {
+    uint64_t key;      // (time << 32) | seq
+    uint32_t time;
+    timer_handler_pt handler;
+    uint32_t interval; // 周期定时器的间隔，0 表示一次性定时器
+    uint8_t mode;      // 周期定时器的重新调度方式
+    uint8_t firing;    // 正在执行回调，此时已不在 B+ 树中
+    uint8_t cancel;    // 回调执行期间被 del_timer 取消
+    timer_entry_t *next; // expire_timer 摘下的到期定时器串成链表
+};
+
+/*
+ * 定时器实例：每个事件循环各自创建一个，实例本身不加锁，只能在创建它的线程中使用
+ * 下面不带 bp_timer_ 前缀的 init_timer / add_timer / ... 操作进程内的默认实例
+ */
+typedef struct bp_timer_s {
+    bp_tree_t tree;
+    uint32_t seq;
+} bp_timer_t;
+
+
+static uint32_t current_time() {
+    uint32_t t;
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    t = (uint32_t)ti.tv_sec * 1000;
+    t += ti.tv_nsec / 1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    t = (uint32_t)tv.tv_sec * 1000;
+    t += tv.tv_usec / 1000;
+#endif
+    return t;
+}
+
+
+bp_timer_t* bp_timer_create() {
+    bp_timer_t *T = (bp_timer_t *)malloc(sizeof(bp_timer_t));
+    if (T == NULL)
+        return NULL;
+    bp_tree_init(&T->tree);
+    T->seq = 0;
+#ifdef TIMER_USE_POOL
+    if (mem_pool_create_once(&entry_pool, sizeof(timer_entry_t), TIMER_POOL_SLAB, TIMER_POOL_FLAGS) == NULL) {
+        free(T);
+        return NULL;
+    }
+#endif
+    return T;
+}
+
+
+void bp_timer_destroy(bp_timer_t *T) {  // 释放实例以及其中尚未到期的定时器
+    void *batch[TIMER_EXPIRE_BATCH];
+    unsigned i, n;
+    while ((n = bp_tree_pop_le(&T->tree, UINT64_MAX, batch, TIMER_EXPIRE_BATCH)) > 0)
+        for (i = 0; i < n; i++)
+            timer_pool_free(entry_pool, (timer_entry_t *)batch[i]);
+    bp_tree_destroy(&T->tree);
+    free(T);
+}
+
+#ifdef TIMER_USE_POOL
+void get_pool_stats(mem_pool_stats_t *st) {
+    mem_pool_stats(entry_pool, st);
+}
+#endif
+
+static int timer_insert(bp_timer_t *T, timer_entry_t *te, uint32_t time) {
+    te->time = time;
+    te->key = (uint64_t)time << 32 | T->seq++;
+    return bp_tree_insert(&T->tree, te->key, te);
+}
+
+
+timer_entry_t* bp_timer_add(bp_timer_t *T, uint32_t msec, timer_handler_pt func) {
+    timer_entry_t *te = timer_pool_alloc(entry_pool, timer_entry_t);
+    if (te == NULL)
+        return NULL;
+    memset(te, 0, sizeof(*te));
+
+    te->handler = func;
+    msec += current_time();
+    if (timer_insert(T, te, msec) != 0) {
+        timer_pool_free(entry_pool, te);
+        return NULL;
+    }
+
+    return te;
+}
+
+
+timer_entry_t* bp_timer_add_periodic(bp_timer_t *T, uint32_t interval, timer_handler_pt func, int mode) {  // 周期定时任务，回调之后重新插入，直到 del_timer
+    timer_entry_t *te = bp_timer_add(T, interval, func);
+    if (te == NULL)
+        return NULL;
+    te->interval = interval;
+    te->mode = mode;
+
+    return te;
+}
+
+
+void bp_timer_del(bp_timer_t *T, timer_entry_t *te) {
+    if (te->firing) {  // 回调中取消自己或同一批到期的定时器，由 expire_timer 负责释放
+        te->cancel = 1;
+        return;
+    }
+    bp_tree_delete(&T->tree, te->key);
+    timer_pool_free(entry_pool, te);
+}
+
+
+int bp_timer_nearest(bp_timer_t *T) {
+    if (bp_tree_empty(&T->tree)) {
+        return -1;
+    }
+    int diff = (int)(uint32_t)(bp_tree_min_key(&T->tree) >> 32) - (int)current_time();  // O(1)，最左叶子的第一个 key
+
+    return diff > 0 ? diff : 0;
+}
+
+
+void bp_timer_expire(bp_timer_t *T) {
+    timer_entry_t *te, *head = NULL, **tail = &head, *batch[TIMER_EXPIRE_BATCH];
+    unsigned i, n;
+    uint32_t now = current_time();
+    uint64_t limit = (uint64_t)now << 32 | 0xffffffff;
+    // 先按顺序从最左叶子整段摘下调用开始时已到期的全部定时器，标记为 firing 并串成链表，再执行回调：
+    //   回调中新加入的、周期任务重新插入的定时器即使已到期也留到下一次 expire_timer，
+    //   回调里 del_timer 已摘下的定时器只打标记
+    while ((n = bp_tree_pop_le(&T->tree, limit, (void **)batch, TIMER_EXPIRE_BATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            batch[i]->firing = 1;
+            *tail = batch[i];
+            tail = &batch[i]->next;
+        }
+    }
+    *tail = NULL;
+
+    while (head) {
+        te = head;
+        head = te->next;
+        if (!te->cancel) {
+            te->handler(te);
+        }
+        te->firing = 0;
+        if (!te->cancel && te->interval
+            && timer_insert(T, te, (te->mode == TIMER_FIXED_DELAY ? current_time() : te->time) + te->interval) == 0) {
+            continue;
+        }
+        timer_pool_free(entry_pool, te);
+    }
+}
+
+/* 默认实例，兼容原来的全局接口 */
+static bp_timer_t *default_timer;
+
+bp_tree_t* init_timer() {
+    default_timer = bp_timer_create();
+    return &default_timer->tree;
+}
+
+timer_entry_t* add_timer(uint32_t msec, timer_handler_pt func) {
+    return bp_timer_add(default_timer, msec, func);
+}
+
+timer_entry_t* add_periodic_timer(uint32_t interval, timer_handler_pt func, int mode) {
+    return bp_timer_add_periodic(default_timer, interval, func, mode);
+}
+
+void del_timer(timer_entry_t *te) {
+    bp_timer_del(default_timer, te);
+}
+
+int find_nearst_expire_timer() {
+    return bp_timer_nearest(default_timer);
+}
+
+void expire_timer() {
+    bp_timer_expire(default_timer);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bptree_timer.h"
+
+/*
+ * bptree_timer 的回归测试
+ *   每个用例返回失败的次数，全部通过时退出码为 0
+ */
+#define READD_CAP 1000  // 旧实现中自我重新加入的回调在一次 expire 内无限循环，用上限让它能结束
+
+static bp_timer_t *T;
+static int nfired;
+
+static void readd(timer_entry_t *te) {
+    (void)te;
+    if (++nfired < READD_CAP)
+        bp_timer_add(T, 0, readd);
+}
+
+static void count(timer_entry_t *te) {
+    (void)te;
+    nfired++;
+}
+
+/*
+ * 回调中以 0 毫秒重新加入自己：一次 expire 只执行调用开始时已到期的定时器，新加入的留到下一次
+ */
+static int test_readd_zero() {
+    int fail = 0;
+
+    T = bp_timer_create();
+    nfired = 0;
+    bp_timer_add(T, 0, readd);
+    bp_timer_expire(T);
+    if (nfired != 1) {
+        printf("FAIL readd_zero: first expire fired %d, want 1\n", nfired);
+        fail++;
+    }
+    bp_timer_expire(T);
+    if (nfired != 2) {
+        printf("FAIL readd_zero: second expire fired %d in total, want 2\n", nfired);
+        fail++;
+    }
+    bp_timer_destroy(T);
+    return fail;
+}
+
+/*
+ * 落后的固定频率周期任务：重新插入后仍已到期，但一次 expire 只执行一次，不会把积压的次数一起补上
+ */
+static int test_periodic_backlog() {
+    timer_entry_t *te;
+    int fail = 0;
+
+    T = bp_timer_create();
+    nfired = 0;
+    te = bp_timer_add_periodic(T, 1, count, TIMER_FIXED_RATE);
+    usleep(20 * 1000);
+    bp_timer_expire(T);
+    if (nfired != 1) {
+        printf("FAIL periodic_backlog: one expire fired %d times, want 1\n", nfired);
+        fail++;
+    }
+    bp_timer_del(T, te);
+    bp_timer_destroy(T);
+    return fail;
+}
+
+int main() {
+    int fail = 0;
+
+    fail += test_readd_zero();
+    fail += test_periodic_backlog();
+    printf("%s\n", fail ? "FAILED" : "ok");
+    return fail != 0;
+}
+
+// gcc -O2 bptree_timer_test.c bptree.c -o bpt_test
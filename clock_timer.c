@@ -1,510 +1,867 @@
-/**
- *   it's too damn hard
- * 
- *   该定时器有三个时间概念：1.定时器维护的内部时间time，手动增加
- *                          2.系统时间，自动增加
- *                          3.定时任务的超时时间，手动设定
- *   
- * 判断定时任务是否超时的依据是 定时器的内部时间time，系统时间只用作定时器内部时间推进的参考
- */
-
-
-#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "clock_timer.h"
-#include <linux/time.h>
-
-#include "spinlock.h"
-
-
-#define SECONDS 60
-#define MINUTES 60
-#define HOURS   12
-#define ONE_HOUR 3600
-#define ONE_MINUTE 60
-#define HALF_DAY 43200 // 12*3600
-
-
-typedef struct link_list {
-    timer_node_t head;
-    timer_node_t *tail;
-} link_list_t;
-
-typedef struct timer {
-    link_list_t second[SECONDS];
-    link_list_t minute[MINUTES];
-    link_list_t hour[HOURS];
-    spinlock_t lock;
-    uint32_t time;
-    time_t current_point;       
-} timer_st;
-
-static timer_st * TI = NULL;
-
-static timer_node_t * link_clear(link_list_t *list) {
-    timer_node_t * ret = list->head.next;
-    list->head.next = 0;
-    list->tail = &(list->head);
-
-    return ret;
-}
-
-static void link_to(link_list_t *list, timer_node_t *node) {
-    list->tail->next = node;
-    list->tail = node;
-    node->next = 0;
-}
-
-static void add_node(timer_st *T, timer_node_t *node) {
-    uint32_t time = node->expire;
-    uint32_t current_time = T->time;
-    uint32_t mesc = time - current_time;
-    if (mesc < ONE_MINUTE) {
-        link_to(&T->second[time % SECONDS], node);
-    } else if (mesc < ONE_HOUR) {
-        link_to(&T->minute[(uint32_t)(time/ONE_MINUTE) % MINUTES], node);
-    } else {
-        link_to(&T->hour[(uint32_t)(time/ONE_HOUR) % HOURS], node);
-    }
-}
-
-
-static void remap(timer_st *T, link_list_t *level, int idx) {
-    timer_node_t *current = link_clear(&level[idx]);
-    while (current) {
-        timer_node_t *temp = current->next;
-        add_node(T, current);
-        current = temp;
-    }
-}
-
-// 根据当前的时间推进定时器系统，并将任务从较高层级的时间轮槽（如分钟或小时槽）移动到较低层级的时间轮槽（如秒槽），确保定时器任务在正确的时间被触发
-static void timer_shift(timer_st *T) { 
-    uint32_t ct = ++T->time % HALF_DAY;  // 定时器的时间time + 1
-    if (ct == 0) {  // 已经过去了12小时，43200秒
-        remap(T, T->hour, 0); // 将 hour 槽中的所有定时器节点移动到较低层级的槽（分钟或秒）
-    } else {  // 每分钟或每小时重映射分钟或小时槽
-        if (ct % SECONDS == 0) { // 当前时间是否整分钟
-            {
-                uint32_t idx = (uint32_t)(ct / ONE_MINUTE) % MINUTES; 
-                if (idx != 0) { // 表示当前时间不是整小时
-                    remap(T, T->minute, idx); // 将重新映射到秒槽中
-                    return;
-                }
-            }
-            {
-                uint32_t idx = (uint32_t)(ct / ONE_HOUR) % HOURS;
-                if (idx != 0) { // 表示当前时间不是整天的开始
-                    remap(T, T->hour, idx); // 将重新映射到分钟槽中
-                }
-            }
-        }
-    }
-    /**
-     * 1.每分钟将一个分钟槽的节点映射到秒槽中
-     * 2.每小时将一个小时槽的节点映射到分钟槽中
-     * 3.hour的0槽需要额外判断处理，因为最后一次hour槽的映射 uint32_t idx = (uint32_t)(ct / ONE_HOUR) % HOURS;没有包括超时时间是12小时的情况
-     */
-}
-
-
-static void dispath_list(timer_node_t *current) {
-    do {
-        timer_node_t * temp = current;
-        current = current->next;
-        if (temp->cancel == 0)
-            temp->callback(temp);
-        free(temp);
-    } while (current);
-}
-
-
-static void timer_execute(timer_st *T) {
-    uint32_t idx = T->time % SECONDS;   // 每一次执行最小时间单位槽-->秒 中的定时器任务
-
-    while (T->second[idx].head.next) {
-        timer_node_t *current = link_clear(&T->second[idx]);
-        spinklock_unlock(&T->lock);
-        dispatch_list(current);
-        spinlock_lock(&T->lock);
-    }
-}
-
-
-static void timer_update(timer_st *T) {
-    spinlock_lock(&T->lock);
-    timer_execute(T);
-    timer_shift(T);
-    timer_execute(T);
-    spinlock_unlock(&T->lock);
-}
-
-
-static timer_st * craete_timer() {
-    timer_st *r = (timer_st *)malloc(sizeof(timer_st));
-    memset(r, 0, sizeof(*r));
-
-    int i;
-    for(i = 0; i < SECONDS; i++) {
-        link_clear(&r->second[i]);
-    }
-    for(i = 0; i < SECONDS; i++) {
-        link_clear(&r->minute[i]);
-    }
-    for(i = 0; i < SECONDS; i++) {
-        link_clear(&r->hour[i]);
-    }
-
-    spinlock_init(&r->lock);
-
-    r->time = 0;
-
-    return r;
-}
-
-
-void init_timer(void) {
-    TI = create_timer();
-    TI->current_point = now_time();
-}
-
-
-timer_node_t *add_timer(int time, handler_pt func) {
-    timer_node_t *node = (timer_node_t *)malloc(sizeof(*node));
-    spinlock_lock(&TI->lock);
-    node->expire = time + TI->time;
-    
-    ptinrf("add timer at %u, expire at %u, now_time at %lu\n", TI->time, node->expire, now_time());
-
-    node->callback = func;
-    node->cancel = 0;
-    if (time <= 0) {
-        spinlock_unlock(&TI-> lock);
-        node->callback(node);
-        free(node);
-
-        return NULL;
-    }
-    add_node(TI, node);
-    spinlock_unlock(&TI->lock);
-
-    return node;
-}
-
-
-void del_timer(timer_node_t *node) {
-    node->cancel = 1;
-}
-
-void check_timer(int *stop) {  //  同步系统时间和定时器的当前时间
-    while (*stop == 0) {
-        time_t cp = now_time();
-        if (cp != TI->current_point) {
-            uint32_t diff = (uint32_t)(cp - TI->current_point);
-            TI->current_point = cp;
-            int i;
-            for (i = 0; i < diff; i++) {  // 推进定时器，补偿时间差
-                timer_update(TI);
-            }
-        }
-        usleep(200000);
-    }
-}
-
-
-void clear_timer() {
-    int i;
-    for (i = 0; i < SECONDS; i++) {
-        link_list_t *list = &TI->second[i];
-        timer_node_t *current = list->head.next;
-        while (current) {
-            timer_node_t *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->second[i]);
-    }
-    for (i = 0; i < MINUTES; i++) {
-        link_list_t * list = &TI->minute[i];
-        timer_node_t *current = list->head.next;
-        while(current) {
-            timer_node_t *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->hour[i]);
-    }
-    for (i = 0; i < HOURS; i++) {
-        link_list_t * list = &TI->hour[i];
-        timer_node_t *current = list->head.next;
-        while (current) {
-            timer_node_t *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->hour[i]);
-    }
-}
-
-
-time_t now_time() {
-    struct timespec ti;
-    clock_gettime(CLOCK_MONOTONIC, &ti);
-
-    return ti.tv_sec;
-}
-
-
-
-#if 0
-/* 这是chatgpt做的优化 :
-主要修改点
-T->time 的初始化:
-
-在 create_timer 函数中添加了 T->time 的初始化为 0。
-Remap 逻辑的优化:
-
-timer_shift 函数中的逻辑已经优化，确保了小时槽在12小时和非整点时正确重新映射。
-
-*/
-
-#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include "spinlock.h"
-
-#define SECONDS 60
-#define MINUTES 60
-#define HOURS 12
-#define ONE_HOUR 3600
-#define ONE_MINUTE 60
-#define HALF_DAY 43200 // 12*3600
-
-typedef void (*handler_pt)(struct timer_node *);
-
-struct timer_node {
-    struct timer_node *next;
-    uint32_t expire;
-    handler_pt callback;
-    uint8_t cancel;
-};
-
-typedef struct link_list {
-    struct timer_node head;
-    struct timer_node *tail;
-} link_list_t;
-
-typedef struct timer {
-    link_list_t second[SECONDS];
-    link_list_t minute[MINUTES];
-    link_list_t hour[HOURS];
-    spinlock_t lock;
-    uint32_t time;
-    time_t current_point;
-} timer_st;
-
-static timer_st *TI = NULL;
-
-static struct timer_node *
-link_clear(link_list_t *list) {
-    struct timer_node *ret = list->head.next;
-    list->head.next = NULL;
-    list->tail = &(list->head);
-    return ret;
-}
-
-static void
-link_to(link_list_t *list, struct timer_node *node) {
-    list->tail->next = node;
-    list->tail = node;
-    node->next = NULL;
-}
-
-static void
-add_node(timer_st *T, struct timer_node *node) {
-    uint32_t time = node->expire;
-    uint32_t current_time = T->time;
-    uint32_t msec = time - current_time;
-    if (msec < ONE_MINUTE) {
-        link_to(&T->second[time % SECONDS], node);
-    } else if (msec < ONE_HOUR) {
-        link_to(&T->minute[(time / ONE_MINUTE) % MINUTES], node);
-    } else {
-        link_to(&T->hour[(time / ONE_HOUR) % HOURS], node);
-    }
-}
-
-static void
-remap(timer_st *T, link_list_t *level, int idx) {
-    struct timer_node *current = link_clear(&level[idx]);
-    while (current) {
-        struct timer_node *temp = current->next;
-        add_node(T, current);
-        current = temp;
-    }
-}
-
-static void
-timer_shift(timer_st *T) {
-    uint32_t ct = ++T->time % HALF_DAY;
-    if (ct % SECONDS == 0) {  // 当前时间为整分钟
-        // 每分钟重新分配一次
-        uint32_t minute_idx = (ct / ONE_MINUTE) % MINUTES;
-        if (minute_idx != 0) {
-            remap(T, T->minute, minute_idx);
-        }
-
-        // 每小时重新分配一次
-        if (ct % ONE_HOUR == 0) {
-            uint32_t hour_idx = (ct / ONE_HOUR) % HOURS;
-            remap(T, T->hour, hour_idx);
-        }
-    }
-}
-
-
-static void
-dispatch_list(struct timer_node *current) {
-    while (current) {
-        struct timer_node *temp = current;
-        current = current->next;
-        if (!temp->cancel) {
-            temp->callback(temp);
-        }
-        free(temp);
-    }
-}
-
-static void
-timer_execute(timer_st *T) {
-    uint32_t idx = T->time % SECONDS;
-    while (T->second[idx].head.next) {
-        struct timer_node *current = link_clear(&T->second[idx]);
-        spinlock_unlock(&T->lock);
-        dispatch_list(current);
-        spinlock_lock(&T->lock);
-    }
-}
-
-static void
-timer_update(timer_st *T) {
-    spinlock_lock(&T->lock);
-    timer_execute(T);
-    timer_shift(T);
-    timer_execute(T);
-    spinlock_unlock(&T->lock);
-}
-
-static timer_st *
-create_timer() {
-    timer_st *r = (timer_st *)malloc(sizeof(timer_st));
-    memset(r, 0, sizeof(*r));
-    
-    r->time = 0;  // 初始化 time 为 0
-    r->current_point = now_time(); // 初始化 current_point 为当前系统时间
-
-    for (int i = 0; i < SECONDS; i++) {
-        link_clear(&r->second[i]);
-    }
-    for (int i = 0; i < MINUTES; i++) {
-        link_clear(&r->minute[i]);
-    }
-    for (int i = 0; i < HOURS; i++) {
-        link_clear(&r->hour[i]);
-    }
-    spinlock_init(&r->lock);
-    return r;
-}
-
-void
-init_timer(void) {
-    TI = create_timer();
-}
-
-struct timer_node *
-add_timer(int time, handler_pt func) {
-    struct timer_node *node = (struct timer_node *)malloc(sizeof(*node));
-    spinlock_lock(&TI->lock);
-    node->expire = time + TI->time;
-    printf("add timer at %u, expire at %u, now_time at %lu\n", TI->time, node->expire, now_time());
-    node->callback = func;
-    node->cancel = 0;
-    if (time <= 0) {
-        spinlock_unlock(&TI->lock);
-        node->callback(node);
-        free(node);
-        return NULL;
-    }
-    add_node(TI, node);
-    spinlock_unlock(&TI->lock);
-    return node;
-}
-
-void
-del_timer(struct timer_node *node) {
-    node->cancel = 1;
-}
-
-void
-check_timer(int *stop) {
-    while (*stop == 0) {
-        time_t cp = now_time();
-        if (cp != TI->current_point) {
-            uint32_t diff = (uint32_t)(cp - TI->current_point);
-            TI->current_point = cp;
-            for (uint32_t i = 0; i < diff; i++) {
-                timer_update(TI);
-            }
-        }
-        usleep(200000); // 200ms
-    }
-}
-
-void
-clear_timer() {
-    for (int i = 0; i < SECONDS; i++) {
-        link_list_t *list = &TI->second[i];
-        struct timer_node *current = list->head.next;
-        while (current) {
-            struct timer_node *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->second[i]);
-    }
-    for (int i = 0; i < MINUTES; i++) {
-        link_list_t *list = &TI->minute[i];
-        struct timer_node *current = list->head.next;
-        while (current) {
-            struct timer_node *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->minute[i]);
-    }
-    for (int i = 0; i < HOURS; i++) {
-        link_list_t *list = &TI->hour[i];
-        struct timer_node *current = list->head.next;
-        while (current) {
-            struct timer_node *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->hour[i]);
-    }
-}
-
-time_t
-now_time() {
-    struct timespec ti;
-    clock_gettime(CLOCK_MONOTONIC, &ti);
-    return ti.tv_sec;
-}
-
-#else
+/**
+ *   it's too damn hard
+ * 
+ *   该定时器有三个时间概念：1.定时器维护的内部时间time，手动增加
+ *                          2.系统时间，自动增加
+ *                          3.定时任务的超时时间，手动设定
+ *   
+ * 判断定时任务是否超时的依据是 定时器的内部时间time，系统时间只用作定时器内部时间推进的参考
+ */
+
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include "clock_timer.h"
+
+#include "spinlock.h"
+#include "mempool.h"
+
+
+#define SECONDS 60
+#define MINUTES 60
+#define HOURS   24
+#define DAYS    64     // 天槽，覆盖 64 天；更远的定时器每 64 天重新放入一次天槽
+#define ONE_HOUR 3600
+#define ONE_MINUTE 60
+#define ONE_DAY 86400  // 24*3600
+
+
+#define TIMER_NODE_LINKED 1 // 挂在某个槽位的链表上
+#define TIMER_NODE_FIRING 2 // 已从槽位取出，等待或正在执行回调
+
+typedef struct link_list {  // 双向循环链表，head 为哨兵
+    timer_node_t head;
+} link_list_t;
+
+struct timer {
+    link_list_t second[SECONDS];
+    link_list_t minute[MINUTES];
+    link_list_t hour[HOURS];
+    link_list_t day[DAYS];
+    uint64_t second_bits;       // 非空槽位的位图，用于计算下一次需要醒来的时间
+    uint64_t minute_bits;
+    uint64_t hour_bits;
+    uint64_t day_bits;
+    spinlock_t lock;
+    uint32_t time;
+    time_t current_point;       
+    time_t origin;              // 内部时间为 0 时对应的系统时间
+    timer_stats_t stats;        // 持有 lock 时更新
+    int flags;
+    int fd;                     // clock_timer_fd 创建的 timerfd，没有时为 -1
+    time_t armed;               // fd 当前设定的唤醒时间（CLOCK_MONOTONIC 秒），0 表示未设定
+};
+
+static timer_st * TI = NULL;   // init_timer 创建的默认实例
+
+#ifdef TIMER_USE_POOL
+static mem_pool_t *node_pool;  // 所有实例共享
+#endif
+
+static inline void timer_lock(timer_st *T) {
+    if (!(T->flags & TIMER_UNLOCKED))
+        spinlock_lock(&T->lock);
+}
+
+static inline void timer_unlock(timer_st *T) {
+    if (!(T->flags & TIMER_UNLOCKED))
+        spinlock_unlock(&T->lock);
+}
+
+static void link_init(link_list_t *list) {
+    list->head.next = &list->head;
+    list->head.prev = &list->head;
+}
+
+static timer_node_t * link_clear(link_list_t *list) {  // 取出整个链表，返回以 NULL 结尾的单链表
+    timer_node_t * ret = NULL;
+    if (list->head.next != &list->head) {
+        ret = list->head.next;
+        list->head.prev->next = NULL;
+    }
+    link_init(list);
+
+    return ret;
+}
+
+static void link_to(link_list_t *list, timer_node_t *node) {
+    node->prev = list->head.prev;
+    node->next = &list->head;
+    list->head.prev->next = node;
+    list->head.prev = node;
+}
+
+static void link_unlink(timer_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static void add_node(timer_st *T, timer_node_t *node) {
+    uint32_t current_time = T->time;
+    if ((int32_t)(node->expire - current_time) < 0)  // 已经过期的节点放到当前槽
+        node->expire = current_time;
+    uint32_t time = node->expire;
+    uint32_t mesc = time - current_time;
+    node->state = TIMER_NODE_LINKED;
+    if (mesc < ONE_MINUTE) {
+        node->level = 0;
+        link_to(&T->second[time % SECONDS], node);
+        T->second_bits |= 1ull << (time % SECONDS);
+    } else if (mesc < ONE_HOUR) {
+        node->level = 1;
+        link_to(&T->minute[(uint32_t)(time/ONE_MINUTE) % MINUTES], node);
+        T->minute_bits |= 1ull << ((uint32_t)(time/ONE_MINUTE) % MINUTES);
+    } else if (mesc < ONE_DAY) {
+        node->level = 2;
+        link_to(&T->hour[(uint32_t)(time/ONE_HOUR) % HOURS], node);
+        T->hour_bits |= 1ull << ((uint32_t)(time/ONE_HOUR) % HOURS);
+    } else {  // 一天以上的定时器在到期前一天之内才离开天槽
+        node->level = 3;
+        link_to(&T->day[(uint32_t)(time/ONE_DAY) % DAYS], node);
+        T->day_bits |= 1ull << ((uint32_t)(time/ONE_DAY) % DAYS);
+    }
+}
+
+
+static void unlink_node(timer_st *T, timer_node_t *node) {  // 从槽位摘除，槽位变空时清除位图
+    uint32_t idx;
+    link_unlink(node);
+    if (node->level == 0) {
+        idx = node->expire % SECONDS;
+        if (T->second[idx].head.next == &T->second[idx].head)
+            T->second_bits &= ~(1ull << idx);
+    } else if (node->level == 1) {
+        idx = (node->expire / ONE_MINUTE) % MINUTES;
+        if (T->minute[idx].head.next == &T->minute[idx].head)
+            T->minute_bits &= ~(1ull << idx);
+    } else if (node->level == 2) {
+        idx = (node->expire / ONE_HOUR) % HOURS;
+        if (T->hour[idx].head.next == &T->hour[idx].head)
+            T->hour_bits &= ~(1ull << idx);
+    } else {
+        idx = (node->expire / ONE_DAY) % DAYS;
+        if (T->day[idx].head.next == &T->day[idx].head)
+            T->day_bits &= ~(1ull << idx);
+    }
+}
+
+
+static void remap(timer_st *T, link_list_t *level, uint64_t *bits, int idx) {
+    timer_node_t *current = link_clear(&level[idx]);
+    *bits &= ~(1ull << idx);
+    while (current) {
+        timer_node_t *temp = current->next;
+        add_node(T, current);
+        T->stats.cascaded++;
+        current = temp;
+    }
+}
+
+// 根据当前的时间推进定时器系统，并将任务从较高层级的时间轮槽（如分钟或小时槽）移动到较低层级的时间轮槽（如秒槽），确保定时器任务在正确的时间被触发
+static void timer_shift(timer_st *T) {
+    uint32_t ct = ++T->time;  // 定时器的时间time + 1
+    if (ct % ONE_MINUTE != 0)
+        return;
+    remap(T, T->minute, &T->minute_bits, (ct / ONE_MINUTE) % MINUTES);  // 整分钟：当前分钟槽映射到秒槽
+    if ((ct / ONE_MINUTE) % MINUTES != 0)
+        return;
+    remap(T, T->hour, &T->hour_bits, (ct / ONE_HOUR) % HOURS);  // 整点：当前小时槽映射到分钟槽
+    if ((ct / ONE_HOUR) % HOURS != 0)
+        return;
+    remap(T, T->day, &T->day_bits, (ct / ONE_DAY) % DAYS);  // 零点：当前天槽映射到小时槽
+    /**
+     * 每一层的当前槽都要映射，包括下标为 0 的槽：minute[0] 中是整点后第一分钟到期的节点，
+     * 整点时先映射它，再映射小时槽；小时槽、天槽同理
+     * 上一层映射下来的节点距离到期不到一个单位，不会落回本层刚映射过的槽
+     */
+}
+
+
+static void dispath_list(timer_st *T, timer_node_t *current) {
+    do {
+        timer_node_t * temp = current;
+        current = current->next;
+        if (temp->cancel == 0)
+            temp->callback(temp);
+        if (temp->cancel == 0 && temp->interval) { // 周期任务：复用原节点重新插入
+            timer_lock(T);
+            if (temp->mode == TIMER_FIXED_DELAY)
+                temp->expire = (uint32_t)(now_time() - T->origin) + temp->interval;
+            else
+                temp->expire += temp->interval;
+            add_node(T, temp);
+            timer_unlock(T);
+        } else {
+            timer_pool_free(node_pool, temp);
+        }
+    } while (current);
+}
+
+
+static void timer_execute(timer_st *T) {
+    uint32_t idx = T->time % SECONDS;   // 每一次执行最小时间单位槽-->秒 中的定时器任务
+
+    while (T->second[idx].head.next != &T->second[idx].head) {
+        timer_node_t *current = link_clear(&T->second[idx]);
+        timer_node_t *node;
+        T->second_bits &= ~(1ull << idx);
+        for (node = current; node; node = node->next)  // 释放锁之前标记，del_timer 不再从链表摘除
+            node->state = TIMER_NODE_FIRING;
+        timer_unlock(T);
+        dispath_list(T, current);
+        timer_lock(T);
+    }
+}
+
+
+
+
+timer_st * clock_timer_create(int flags) {
+#ifdef TIMER_USE_POOL
+    if (mem_pool_create_once(&node_pool, sizeof(timer_node_t), TIMER_POOL_SLAB, TIMER_POOL_FLAGS) == NULL)
+        return NULL;
+#endif
+    timer_st *r = (timer_st *)malloc(sizeof(timer_st));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+
+    int i;
+    for(i = 0; i < SECONDS; i++) {
+        link_init(&r->second[i]);
+    }
+    for(i = 0; i < MINUTES; i++) {
+        link_init(&r->minute[i]);
+    }
+    for(i = 0; i < HOURS; i++) {
+        link_init(&r->hour[i]);
+    }
+    for(i = 0; i < DAYS; i++) {
+        link_init(&r->day[i]);
+    }
+
+    spinlock_init(&r->lock);
+
+    r->time = 0;
+    r->flags = flags;
+    r->current_point = now_time();
+    r->origin = r->current_point;
+    r->fd = -1;
+
+    return r;
+}
+
+
+static void timer_clear(timer_st *T);
+static int64_t next_event(timer_st *T);
+
+/*
+ * 持有锁时调用，把 fd 设定到下一次需要推进的整秒（下一个非空秒槽或重新映射点），没有节点时停止
+ *   force 为 0 时只在新的时间更早时才重新设定：add 之后调用，del 不调用，多醒一次由 expire 重新设定
+ */
+static void timer_arm(timer_st *T, int force) {
+#ifdef __linux__
+    struct itimerspec its;
+    int64_t d;
+    time_t target;
+
+    if (T->fd < 0)
+        return;
+    d = next_event(T);
+    target = d < 0 ? 0 : T->current_point + d;
+    if (!force && T->armed && (target == 0 || target >= T->armed))
+        return;
+    if (force && target == T->armed)
+        return;
+    memset(&its, 0, sizeof(its));  // it_value 全为 0 时停止
+    its.it_value.tv_sec = target;
+    timerfd_settime(T->fd, TFD_TIMER_ABSTIME, &its, NULL);
+    T->armed = target;
+#else
+    (void)T;
+    (void)force;
+#endif
+}
+
+void clock_timer_destroy(timer_st *T) {
+    timer_clear(T);
+    if (T->fd >= 0)
+        close(T->fd);
+    free(T);
+}
+
+
+void init_timer(void) {
+    TI = clock_timer_create(0);
+}
+
+#ifdef TIMER_USE_POOL
+void get_pool_stats(mem_pool_stats_t *st) {
+    mem_pool_stats(node_pool, st);
+}
+#endif
+
+
+timer_node_t *clock_timer_add(timer_st *T, int time, handler_pt func) {
+    timer_node_t *node = timer_pool_alloc(node_pool, timer_node_t);
+    if (node == NULL)
+        return NULL;
+    timer_lock(T);
+    node->expire = time + T->time;
+
+    node->callback = func;
+    node->cancel = 0;
+    node->interval = 0;
+    if (time <= 0) {
+        timer_unlock(T);
+        node->callback(node);
+        timer_pool_free(node_pool, node);
+
+        return NULL;
+    }
+    add_node(T, node);
+    timer_arm(T, 0);
+    timer_unlock(T);
+
+    return node;
+}
+
+
+timer_node_t *clock_timer_add_periodic(timer_st *T, int interval, handler_pt func, int mode) {
+    if (interval <= 0) {
+        return NULL;
+    }
+    timer_node_t *node = timer_pool_alloc(node_pool, timer_node_t);
+    if (node == NULL)
+        return NULL;
+    node->callback = func;
+    node->cancel = 0;
+    node->interval = interval;
+    node->mode = mode;
+
+    timer_lock(T);
+    node->expire = interval + T->time;
+    add_node(T, node);
+    timer_arm(T, 0);
+    timer_unlock(T);
+
+    return node;
+}
+
+
+static unsigned pending_cascades(timer_node_t *node) {  // 节点到期前还要被 remap 的次数
+    static const uint32_t unit[] = {1, ONE_MINUTE, ONE_HOUR, ONE_DAY};
+    uint32_t rest;
+    unsigned n;
+    int l = node->level;
+    if (l == 0)
+        return 0;
+    // 本层映射一次，之后余下的时间不足下一层的一个单位时直接跳过那一层
+    rest = node->expire % unit[l];
+    for (n = 1; --l > 0; ) {
+        if (rest >= unit[l]) {
+            n++;
+            rest %= unit[l];
+        }
+    }
+    return n;
+}
+
+void clock_timer_del(timer_st *T, timer_node_t *node) {
+    timer_lock(T);
+    if (node->state == TIMER_NODE_LINKED) {
+        unlink_node(T, node);
+        T->stats.removed++;
+        T->stats.removed_bytes += sizeof(timer_node_t);
+        T->stats.cascade_avoided += pending_cascades(node);
+        timer_unlock(T);
+        timer_pool_free(node_pool, node);
+        return;
+    }
+    node->cancel = 1;  // 正在执行，由 dispath_list 释放
+    timer_unlock(T);
+}
+
+void clock_timer_stats(timer_st *T, timer_stats_t *st) {
+    timer_lock(T);
+    *st = T->stats;
+    timer_unlock(T);
+}
+
+#ifdef SPINLOCK_STATS
+void clock_timer_lock_stats(timer_st *T, spinlock_stats_t *st) {
+    spinlock_stats(&T->lock, st);
+}
+#endif
+
+static int next_bit_circular(uint64_t bits, int n, int start) {  // 从 start 开始循环查找第一个置位的下标，返回与 start 的距离
+    uint64_t hi = bits >> start;
+    if (hi)
+        return __builtin_ctzll(hi);
+    bits &= (1ull << start) - 1;
+    if (bits)
+        return n - start + __builtin_ctzll(bits);
+    return -1;
+}
+
+/*
+ * 距离下一次需要处理的时间还有多少秒，没有任何节点时返回 -1
+ *   秒槽：下一个非空的秒槽；它在下一个整分钟之后时，还要与各层的重新映射点比较
+ *   分钟槽：第 j 个槽在分钟下标为 j 的整分钟重新映射
+ *   小时槽：第 j 个槽在小时下标为 j 的整点重新映射
+ *   天槽：第 j 个槽在天下标为 j 的零点重新映射
+ */
+static int64_t next_event(timer_st *T) {
+    uint32_t ct = T->time;
+    int64_t d = -1, e;
+    int off;
+
+    if (T->second_bits & (1ull << (ct % SECONDS)))
+        return 1;   // 当前槽在下一次推进时执行
+    off = next_bit_circular(T->second_bits, SECONDS, (ct + 1) % SECONDS);
+    if (off >= 0) {
+        // 秒槽中的节点在一分钟以内到期，但可能在下一个整分钟之后，那时要先映射分钟槽；
+        // 不晚于下一个整分钟时才一定是最早的事件
+        if (off + 1 <= (int)(SECONDS - ct % SECONDS))
+            return off + 1;
+        d = off + 1;
+    }
+    off = next_bit_circular(T->minute_bits, MINUTES, (ct / ONE_MINUTE + 1) % MINUTES);
+    if (off >= 0) {
+        e = ((int64_t)ct / ONE_MINUTE + off + 1) * ONE_MINUTE - ct;
+        if (d < 0 || e < d)
+            d = e;
+    }
+    off = next_bit_circular(T->hour_bits, HOURS, (ct / ONE_HOUR + 1) % HOURS);
+    if (off >= 0) {
+        e = ((int64_t)ct / ONE_HOUR + off + 1) * ONE_HOUR - ct;
+        if (d < 0 || e < d)
+            d = e;
+    }
+    off = next_bit_circular(T->day_bits, DAYS, (ct / ONE_DAY + 1) % DAYS);
+    if (off >= 0) {
+        e = ((int64_t)ct / ONE_DAY + off + 1) * ONE_DAY - ct;
+        if (d < 0 || e < d)
+            d = e;
+    }
+    return d;
+}
+
+int clock_timer_nearest(timer_st *T) {
+    struct timespec ti;
+    int64_t d, diff;
+
+    timer_lock(T);
+    d = next_event(T);
+    timer_unlock(T);
+    if (d < 0)
+        return -1;
+
+    // 内部时间 T->time 对应的系统时间是 current_point，系统时间走到 current_point + d 秒时推进
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    diff = ((int64_t)T->current_point + d) * 1000 - ((int64_t)ti.tv_sec * 1000 + ti.tv_nsec / 1000000);
+    if (diff <= 0)
+        return 0;
+    return diff > INT32_MAX ? INT32_MAX : (int)diff;
+}
+
+/*
+ * 推进 n 秒，效果与逐秒执行当前槽、推进一格并重新映射相同
+ * 中间没有非空秒槽、也没有需要映射的槽的秒直接跳过，长时间没有推进后补偿的代价与事件数成正比
+ */
+void clock_timer_advance(timer_st *T, uint32_t n) {
+    int64_t d;
+    timer_lock(T);
+    timer_execute(T);
+    while (n > 0) {
+        d = next_event(T);
+        if (d < 0 || d > n) {  // 剩余的时间内没有任何事件
+            T->time += n;
+            break;
+        }
+        T->time += (uint32_t)(d - 1);  // 跳到事件的前一秒，再由 timer_shift 推进一格并重新映射
+        timer_shift(T);
+        timer_execute(T);
+        n -= (uint32_t)d;
+    }
+    timer_unlock(T);
+}
+
+
+void clock_timer_expire(timer_st *T) {  //  同步系统时间和定时器的当前时间
+    time_t cp = now_time();
+    uint64_t expirations;
+    if (T->fd >= 0)  // 清除 fd 的可读状态，fd 未到期时 read 返回 EAGAIN
+        while (read(T->fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+    if (cp != T->current_point) {
+        uint32_t diff = (uint32_t)(cp - T->current_point);
+        T->current_point = cp;
+        clock_timer_advance(T, diff);  // 推进定时器，补偿时间差
+    }
+    if (T->fd >= 0) {
+        timer_lock(T);
+        timer_arm(T, 1);
+        timer_unlock(T);
+    }
+}
+
+
+int clock_timer_fd(timer_st *T) {
+#ifdef __linux__
+    timer_lock(T);
+    if (T->fd < 0) {
+        T->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (T->fd >= 0) {
+            T->armed = 0;
+            timer_arm(T, 1);
+        }
+    }
+    timer_unlock(T);
+    return T->fd;
+#else
+    (void)T;
+    return -1;
+#endif
+}
+
+
+timer_node_t *add_timer(int time, handler_pt func) {
+    return clock_timer_add(TI, time, func);
+}
+
+timer_node_t *add_periodic_timer(int interval, handler_pt func, int mode) {
+    return clock_timer_add_periodic(TI, interval, func, mode);
+}
+
+void del_timer(timer_node_t *node) {
+    clock_timer_del(TI, node);
+}
+
+void get_timer_stats(timer_stats_t *st) {
+    clock_timer_stats(TI, st);
+}
+
+int find_nearest_expire_timer(void) {
+    return clock_timer_nearest(TI);
+}
+
+void check_timer(int *stop) {
+    struct timespec ts;
+    while (*stop == 0) {
+        clock_timer_expire(TI);
+        // 内部时间只在系统时间跨过整秒时推进，其他线程新加的定时器最早也在下一个整秒到期，
+        // 睡到下一个整秒既不会错过它们，也不会比到期时间晚醒；每秒只醒一次
+        ts.tv_sec = TI->current_point + 1;
+        ts.tv_nsec = 0;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+    }
+}
+
+
+static void timer_clear(timer_st *T) {
+    int i;
+    for (i = 0; i < SECONDS; i++) {
+        timer_node_t *current = link_clear(&T->second[i]);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    for (i = 0; i < MINUTES; i++) {
+        timer_node_t *current = link_clear(&T->minute[i]);
+        while(current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    for (i = 0; i < HOURS; i++) {
+        timer_node_t *current = link_clear(&T->hour[i]);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    for (i = 0; i < DAYS; i++) {
+        timer_node_t *current = link_clear(&T->day[i]);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    T->second_bits = T->minute_bits = T->hour_bits = T->day_bits = 0;
+}
+
+void clear_timer() {
+    timer_clear(TI);
+}
+
+
+time_t now_time() {
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+
+    return ti.tv_sec;
+}
+
+
+
+#if 0
+/* 这是chatgpt做的优化 :
+主要修改点
+T->time 的初始化:
+
+在 create_timer 函数中添加了 T->time 的初始化为 0。
+Remap 逻辑的优化:
+
+timer_shift 函数中的逻辑已经优化，确保了小时槽在12小时和非整点时正确重新映射。
+
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spinlock.h"
+
+#define SECONDS 60
+#define MINUTES 60
+#define HOURS 12
+#define ONE_HOUR 3600
+#define ONE_MINUTE 60
+#define HALF_DAY 43200 // 12*3600
+
+typedef void (*handler_pt)(struct timer_node *);
+
+struct timer_node {
+    struct timer_node *next;
+    uint32_t expire;
+    handler_pt callback;
+    uint8_t cancel;
+};
+
+typedef struct link_list {
+    struct timer_node head;
+    struct timer_node *tail;
+} link_list_t;
+
+typedef struct timer {
+    link_list_t second[SECONDS];
+    link_list_t minute[MINUTES];
+    link_list_t hour[HOURS];
+    spinlock_t lock;
+    uint32_t time;
+    time_t current_point;
+} timer_st;
+
+static timer_st *TI = NULL;
+
+static struct timer_node *
+link_clear(link_list_t *list) {
+    struct timer_node *ret = list->head.next;
+    list->head.next = NULL;
+    list->tail = &(list->head);
+    return ret;
+}
+
+static void
+link_to(link_list_t *list, struct timer_node *node) {
+    list->tail->next = node;
+    list->tail = node;
+    node->next = NULL;
+}
+
+static void
+add_node(timer_st *T, struct timer_node *node) {
+    uint32_t time = node->expire;
+    uint32_t current_time = T->time;
+    uint32_t msec = time - current_time;
+    if (msec < ONE_MINUTE) {
+        link_to(&T->second[time % SECONDS], node);
+    } else if (msec < ONE_HOUR) {
+        link_to(&T->minute[(time / ONE_MINUTE) % MINUTES], node);
+    } else {
+        link_to(&T->hour[(time / ONE_HOUR) % HOURS], node);
+    }
+}
+
+static void
+remap(timer_st *T, link_list_t *level, int idx) {
+    struct timer_node *current = link_clear(&level[idx]);
+    while (current) {
+        struct timer_node *temp = current->next;
+        add_node(T, current);
+        current = temp;
+    }
+}
+
+static void
+timer_shift(timer_st *T) {
+    uint32_t ct = ++T->time % HALF_DAY;
+    if (ct % SECONDS == 0) {  // 当前时间为整分钟
+        // 每分钟重新分配一次
+        uint32_t minute_idx = (ct / ONE_MINUTE) % MINUTES;
+        if (minute_idx != 0) {
+            remap(T, T->minute, minute_idx);
+        }
+
+        // 每小时重新分配一次
+        if (ct % ONE_HOUR == 0) {
+            uint32_t hour_idx = (ct / ONE_HOUR) % HOURS;
+            remap(T, T->hour, hour_idx);
+        }
+    }
+}
+
+
+static void
+dispatch_list(struct timer_node *current) {
+    while (current) {
+        struct timer_node *temp = current;
+        current = current->next;
+        if (!temp->cancel) {
+            temp->callback(temp);
+        }
+        free(temp);
+    }
+}
+
+static void
+timer_execute(timer_st *T) {
+    uint32_t idx = T->time % SECONDS;
+    while (T->second[idx].head.next) {
+        struct timer_node *current = link_clear(&T->second[idx]);
+        spinlock_unlock(&T->lock);
+        dispatch_list(current);
+        spinlock_lock(&T->lock);
+    }
+}
+
+static void
+timer_update(timer_st *T) {
+    spinlock_lock(&T->lock);
+    timer_execute(T);
+    timer_shift(T);
+    timer_execute(T);
+    spinlock_unlock(&T->lock);
+}
+
+static timer_st *
+create_timer() {
+    timer_st *r = (timer_st *)malloc(sizeof(timer_st));
+    memset(r, 0, sizeof(*r));
+    
+    r->time = 0;  // 初始化 time 为 0
+    r->current_point = now_time(); // 初始化 current_point 为当前系统时间
+
+    for (int i = 0; i < SECONDS; i++) {
+        link_clear(&r->second[i]);
+    }
+    for (int i = 0; i < MINUTES; i++) {
+        link_clear(&r->minute[i]);
+    }
+    for (int i = 0; i < HOURS; i++) {
+        link_clear(&r->hour[i]);
+    }
+    spinlock_init(&r->lock);
+    return r;
+}
+
+void
+init_timer(void) {
+    TI = create_timer();
+}
+
+struct timer_node *
+add_timer(int time, handler_pt func) {
+    struct timer_node *node = (struct timer_node *)malloc(sizeof(*node));
+    spinlock_lock(&TI->lock);
+    node->expire = time + TI->time;
+    printf("add timer at %u, expire at %u, now_time at %lu\n", TI->time, node->expire, now_time());
+    node->callback = func;
+    node->cancel = 0;
+    if (time <= 0) {
+        spinlock_unlock(&TI->lock);
+        node->callback(node);
+        free(node);
+        return NULL;
+    }
+    add_node(TI, node);
+    spinlock_unlock(&TI->lock);
+    return node;
+}
+
+void
+del_timer(struct timer_node *node) {
+    node->cancel = 1;
+}
+
+void
+check_timer(int *stop) {
+    while (*stop == 0) {
+        time_t cp = now_time();
+        if (cp != TI->current_point) {
+            uint32_t diff = (uint32_t)(cp - TI->current_point);
+            TI->current_point = cp;
+            for (uint32_t i = 0; i < diff; i++) {
+                timer_update(TI);
+            }
+        }
+        usleep(200000); // 200ms
+    }
+}
+
+void
+clear_timer() {
+    for (int i = 0; i < SECONDS; i++) {
+        link_list_t *list = &TI->second[i];
+        struct timer_node *current = list->head.next;
+        while (current) {
+            struct timer_node *temp = current;
+            current = current->next;
+            free(temp);
+        }
+        link_clear(&TI->second[i]);
+    }
+    for (int i = 0; i < MINUTES; i++) {
+        link_list_t *list = &TI->minute[i];
+        struct timer_node *current = list->head.next;
+        while (current) {
+            struct timer_node *temp = current;
+            current = current->next;
+            free(temp);
+        }
+        link_clear(&TI->minute[i]);
+    }
+    for (int i = 0; i < HOURS; i++) {
+        link_list_t *list = &TI->hour[i];
+        struct timer_node *current = list->head.next;
+        while (current) {
+            struct timer_node *temp = current;
+            current = current->next;
+            free(temp);
+        }
+        link_clear(&TI->hour[i]);
+    }
+}
+
+time_t
+now_time() {
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return ti.tv_sec;
+}
+
+#else
 #endif
\ No newline at end of file
@@ -1,25 +1,82 @@
-#ifndef _MARK_TIMEWHEEL_
-#define _MARK_TIMEWHEEL_
-#include <time.h>
-#include <stdint.h>
-#include <stddef.h>
-
-
-typedef struct timer_node timer_node_t;
-typedef void (*handler_pt) (struct timer_node *node);
-struct timer_node {
-    struct timer_node *next;
-    uint32_t expire;
-    handler_pt callback;
-    uint8_t cancel;
-};
-
-
-void init_timer(void);
-timer_node_t* add_timer(int time, handler_pt func);
-void del_timer(timer_node_t *node);
-void check_timer(int *stop);
-void clear_timer();
-time_t now_time();
-
+#ifndef _MARK_TIMEWHEEL_
+#define _MARK_TIMEWHEEL_
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define TIMER_FIXED_RATE  0 // 固定频率：下次超时时间 = 本次超时时间 + 间隔
+#define TIMER_FIXED_DELAY 1 // 固定延迟：下次超时时间 = 回调返回时的时间 + 间隔
+
+typedef struct timer_node timer_node_t;
+typedef void (*handler_pt) (struct timer_node *node);
+struct timer_node {
+    struct timer_node *next;
+    struct timer_node *prev; // 槽位为双向循环链表，del_timer 可以直接摘除
+    uint32_t expire;
+    handler_pt callback;
+    uint8_t cancel;
+    uint8_t mode;      // 周期任务的重新调度方式
+    uint8_t state;     // 节点当前所处的位置，只在持有锁时读写
+    uint8_t level;     // 所在层级：0 秒，1 分钟，2 小时，3 天
+    uint32_t interval; // 周期任务的间隔（秒），0 表示一次性任务
+};
+
+
+typedef struct timer timer_st;
+
+typedef struct timer_stats_s {
+    uint64_t removed;          // del_timer 直接摘除并释放的节点数
+    uint64_t removed_bytes;    // 这些节点提前归还的内存
+    uint64_t cascaded;         // remap 实际重新映射的节点数
+    uint64_t cascade_avoided;  // 被摘除的节点原本还要经历的重新映射次数
+} timer_stats_t;
+
+/*
+ * 实例接口：每个事件循环可以各自创建一个定时器
+ *   flags 为 0：add / del 可以在任意线程调用，expire 同一时刻只能有一个线程
+ *   TIMER_UNLOCKED：实例只在创建它的线程中使用，所有操作都不加锁
+ */
+#define TIMER_UNLOCKED 0x1
+
+timer_st* clock_timer_create(int flags);
+void clock_timer_destroy(timer_st *T); // 释放实例以及其中所有节点
+timer_node_t* clock_timer_add(timer_st *T, int time, handler_pt func);
+timer_node_t* clock_timer_add_periodic(timer_st *T, int interval, handler_pt func, int mode); // 周期任务，del 取消
+void clock_timer_del(timer_st *T, timer_node_t *node); // 未到期的节点立即摘除并释放，正在执行的节点只打标记
+void clock_timer_expire(timer_st *T); // 按系统时间推进内部时间，执行到期的节点
+void clock_timer_advance(timer_st *T, uint32_t n); // 不读取系统时间，直接推进 n 秒，用于模拟和测试
+int clock_timer_nearest(timer_st *T); // 距离下一个非空槽位或重新映射点的毫秒数，没有定时器时返回 -1
+void clock_timer_stats(timer_st *T, timer_stats_t *st);
+
+/*
+ * fd 模式（Linux timerfd）：返回一个在需要推进时可读的 fd，可以加入已有的 epoll / poll 事件循环
+ *   fd 设定在下一个非空秒槽或重新映射点所在的整秒，没有定时器时不会可读；
+ *   add 带来更早的事件时重新设定，其他线程新加的定时器也能唤醒事件循环
+ *   fd 可读时调用 clock_timer_expire，它会清除可读状态并设定下一次唤醒
+ * 多次调用返回同一个 fd，clock_timer_destroy 时关闭；失败返回 -1
+ */
+int clock_timer_fd(timer_st *T);
+
+/* 以下全局接口操作 init_timer 创建的默认实例 */
+void init_timer(void);
+timer_node_t* add_timer(int time, handler_pt func);
+timer_node_t* add_periodic_timer(int interval, handler_pt func, int mode);
+void del_timer(timer_node_t *node);
+void get_timer_stats(timer_stats_t *st);
+void check_timer(int *stop); // 循环调用 expire，每次睡到下一个整秒（clock_nanosleep），直到 *stop 非零
+int find_nearest_expire_timer(void);
+void clear_timer();
+time_t now_time();
+
+#ifdef TIMER_USE_POOL
+#include "mempool.h"
+void get_pool_stats(mem_pool_stats_t *st);
+#endif
+
+#ifdef SPINLOCK_STATS
+#include "spinlock.h"
+void clock_timer_lock_stats(timer_st *T, spinlock_stats_t *st); // T->lock 的竞争情况
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock_timer.h"
+
+/*
+ * 一百万个多天的定时器（会话、证书刷新）：放入 n 个 MIN_DAYS 到 MAX_DAYS 天的定时器，其中 1/8 在到期前删除，
+ *   然后用 clock_timer_advance 逐秒推进模拟时间直到全部到期
+ *   统计平均每个定时器被 remap 的次数和单次推进一秒的最长耗时（零点时整个天槽映射到小时槽）
+ *   天槽之前只有 12 个小时槽，一天以上的定时器每半天被重新放入一次，30 天的定时器要被访问约 60 次
+ *   add 时记下每个定时器期望的执行时间，回调中与模拟时间比较（node->expire 在迟到 remap 时会被改成当前时间，不能用来判断）
+ *   另跑一组稀疏的：推进过程中每 SPARSE_EVERY 秒加一个定时器，延迟在 1~60 秒、1 秒~1 小时、1 秒~MAX_DAYS 天中随机，秒槽大部分时间为空，
+ *   逐秒推进会跳过空的秒，并且会出现秒槽节点排在分钟槽 remap 之后的情况
+ */
+#define DENSE (1000 * 1000)
+#define SPARSE 20000
+#define SPARSE_EVERY 97
+#define MIN_DAYS 1
+#define MAX_DAYS 30
+#define ONE_DAY 86400
+#define DEADLINE_MAP (1 << 21)  // 大于 DENSE 的 2 的幂
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t sim;  // 与定时器内部时间同步
+static uint64_t fired, wrong, late_max;
+
+// 节点 -> 期望执行时间，开放寻址
+static struct {
+    timer_node_t *node;
+    uint32_t deadline;
+} *deadlines;
+
+static uint32_t *deadline_of(timer_node_t *node) {
+    unsigned i = (unsigned)(((uintptr_t)node >> 4) * 2654435761u) & (DEADLINE_MAP - 1);
+    while (deadlines[i].node && deadlines[i].node != node)
+        i = (i + 1) & (DEADLINE_MAP - 1);
+    deadlines[i].node = node;
+    return &deadlines[i].deadline;
+}
+
+static void handler(timer_node_t *node) {
+    uint32_t deadline = *deadline_of(node);
+    fired++;
+    if (deadline != sim) {
+        wrong++;
+        if (sim > deadline && sim - deadline > late_max)
+            late_max = sim - deadline;
+    }
+}
+
+static uint32_t seed = 2463534242u;
+
+// lo 为 0 时延迟从 1 秒到 60 秒、1 小时、hi 三种范围中随机选一种
+static timer_node_t *add_one(timer_st *T, uint32_t lo, uint32_t hi) {
+    const uint32_t ranges[] = {60, 3600, hi};
+    timer_node_t *node;
+    uint32_t d;
+    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+    d = lo ? lo + seed % (hi - lo) : 1 + seed % ranges[seed % 3];
+    node = clock_timer_add(T, (int)d, handler);
+    *deadline_of(node) = sim + d;
+    return node;
+}
+
+// every 为 0 时一开始放入全部 n 个定时器，否则推进过程中每 every 秒放入一个
+static void run(int n, uint32_t lo, uint32_t hi, uint32_t every) {
+    timer_st *T = clock_timer_create(TIMER_UNLOCKED);
+    timer_node_t **nodes = (timer_node_t **)malloc(n * sizeof(timer_node_t *));
+    uint32_t end = (every ? n * every : 0) + hi + 1;
+    uint64_t t0, t1, add, del, advance, max_ns = 0;
+    timer_stats_t st;
+    int i, added = 0;
+
+    sim = 0;
+    fired = wrong = late_max = 0;
+    memset(deadlines, 0, DEADLINE_MAP * sizeof(*deadlines));
+    t0 = now_ns();
+    for (; !every && added < n; added++)
+        nodes[added] = add_one(T, lo, hi);
+    add = now_ns() - t0;
+    t0 = now_ns();
+    for (i = 0; i < added; i += 8)
+        clock_timer_del(T, nodes[i]);
+    del = now_ns() - t0;
+
+    t0 = now_ns();
+    while (sim < end) {
+        if (every && added < n && sim % every == 0) {
+            nodes[added] = add_one(T, lo, hi);
+            if (added++ % 8 == 0)
+                clock_timer_del(T, nodes[added - 1]);
+        }
+        sim++;
+        t1 = now_ns();
+        clock_timer_advance(T, 1);
+        t1 = now_ns() - t1;
+        if (t1 > max_ns)
+            max_ns = t1;
+    }
+    advance = now_ns() - t0;
+
+    clock_timer_stats(T, &st);
+    if (every)
+        printf("timers=%d seconds=[1,%u] one every %us, advance %u days=%.1fms max_second=%.1fms\n",
+            n, hi, every, end / ONE_DAY, advance / 1e6, max_ns / 1e6);
+    else
+        printf("timers=%d seconds=[%u,%u) add=%.1fns del=%.1fns advance %u days=%.1fms max_second=%.1fms\n",
+            n, lo, hi, (double)add / n, (double)del / ((n + 7) / 8), end / ONE_DAY, advance / 1e6, max_ns / 1e6);
+    printf("fired=%lu/%d wrong=%lu max_late=%lus remap/timer=%.2f cascade_avoided=%lu\n",
+        fired, n - (n + 7) / 8, wrong, late_max, (double)st.cascaded / (n - (n + 7) / 8), st.cascade_avoided);
+    clock_timer_destroy(T);
+    free(nodes);
+}
+
+int main() {
+    deadlines = calloc(DEADLINE_MAP, sizeof(*deadlines));
+    run(DENSE, MIN_DAYS * ONE_DAY, MAX_DAYS * ONE_DAY, 0);
+    run(SPARSE, 0, MAX_DAYS * ONE_DAY, SPARSE_EVERY);
+    free(deadlines);
+    return 0;
+}
+
+// gcc -O2 clock_timer_bench.c clock_timer.c -lpthread -o ck_bench
+// gcc -O2 -DTIMER_USE_POOL clock_timer_bench.c clock_timer.c mempool.c -lpthread -o ck_bench_pool
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include "clock_timer.h"
+
+/*
+ * clock_timer 的回归测试，用 clock_timer_advance 推进模拟时间，不依赖系统时间走动
+ *   每个用例返回失败的次数，全部通过时退出码为 0
+ */
+
+static uint32_t sim;  // 与定时器内部时间同步，回调中就是当前时间
+static uint32_t fired_at[16];
+static int nfired;
+
+static void record(timer_node_t *node) {
+    (void)node;
+    if (nfired < 16)
+        fired_at[nfired] = sim;
+    nfired++;
+}
+
+/*
+ * 节点到期时间的记录：add 时记下期望的执行时间，回调中比较
+ *   不能用 node->expire：remap 迟到时 add_node 会把它改成当前时间
+ *   节点释放后可能被下一次 add 复用，再次记录时直接覆盖，因此不需要删除
+ */
+#define DEADLINE_MAP (1 << 16)
+
+static struct {
+    timer_node_t *node;
+    uint32_t deadline;
+} deadlines[DEADLINE_MAP];
+
+static uint32_t *deadline_of(timer_node_t *node) {
+    unsigned i = (unsigned)(((uintptr_t)node >> 4) * 2654435761u) & (DEADLINE_MAP - 1);
+    while (deadlines[i].node && deadlines[i].node != node)
+        i = (i + 1) & (DEADLINE_MAP - 1);
+    deadlines[i].node = node;
+    return &deadlines[i].deadline;
+}
+
+static uint64_t checked, wrong, late_max;
+
+static void check_deadline(timer_node_t *node) {
+    uint32_t deadline = *deadline_of(node);
+    checked++;
+    if (deadline != sim) {
+        wrong++;
+        if (sim > deadline && sim - deadline > late_max)
+            late_max = sim - deadline;
+    }
+}
+
+static void step(timer_st *T, uint32_t n) {  // 逐秒推进，与 check_timer 每秒醒来一次相同
+    while (n--) {
+        sim++;
+        clock_timer_advance(T, 1);
+    }
+}
+
+/*
+ * 秒槽中的节点在下一个整分钟之后到期时，nearest 要返回整分钟：
+ *   t=0 加一个 70 秒的定时器（分钟槽，t=60 映射），t=50 加一个 20 秒的定时器（秒槽，t=70 到期）
+ *   t=50 时下一件事是 t=60 的映射，而不是 t=70
+ */
+static int test_nearest_before_remap() {
+    timer_st *T = clock_timer_create(TIMER_UNLOCKED);
+    int ms, fail = 0;
+
+    sim = 0;
+    clock_timer_add(T, 70, record);
+    step(T, 50);
+    clock_timer_add(T, 20, record);
+    // advance 不改变 current_point，nearest 就是模拟时间上的距离减去当前这一秒已经过去的部分
+    ms = clock_timer_nearest(T);
+    if (ms <= 9000 || ms > 10000) {
+        printf("FAIL nearest_before_remap: nearest=%dms, want about 10000\n", ms);
+        fail++;
+    }
+    clock_timer_destroy(T);
+    return fail;
+}
+
+/*
+ * fd 模式：整分钟后不久到期的节点要先经过分钟槽映射，fd 的唤醒时间要设在映射点，
+ *   否则它会等到后面的秒槽才执行
+ *   t=0 加一个 62 秒的定时器（分钟槽，t=60 映射），t=50 加一个 20 秒的定时器（秒槽，t=70 到期），
+ *   fd 应在约 10 秒后可读，两个定时器分别在 t=62、t=70 执行
+ */
+static int test_fd_arm_before_remap() {
+#ifdef __linux__
+    timer_st *T = clock_timer_create(TIMER_UNLOCKED);
+    struct itimerspec its;
+    double left;
+    int fd, fail = 0;
+
+    sim = 0;
+    fd = clock_timer_fd(T);
+    if (fd < 0) {
+        printf("FAIL fd_arm_before_remap: clock_timer_fd failed\n");
+        clock_timer_destroy(T);
+        return 1;
+    }
+    nfired = 0;
+    clock_timer_add(T, 62, record);
+    step(T, 50);
+    clock_timer_add(T, 20, record);  // 下一件事是 10 秒后 t=60 的映射，比原来设定的更早，fd 重新设定
+    timerfd_gettime(fd, &its);
+    // advance 不改变 current_point，设定的唤醒时间就是 current_point + 模拟时间上的距离
+    left = its.it_value.tv_sec + its.it_value.tv_nsec / 1e9;
+    if (left <= 9.0 || left > 10.0) {
+        printf("FAIL fd_arm_before_remap: fd fires in %.3fs, want about 10s\n", left);
+        fail++;
+    }
+    step(T, 20);
+    if (nfired != 2 || fired_at[0] != 62 || fired_at[1] != 70) {
+        printf("FAIL fd_arm_before_remap: fired %d timers at %u, %u, want 62, 70\n", nfired, fired_at[0], fired_at[1]);
+        fail++;
+    }
+    clock_timer_destroy(T);
+    return fail;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * 秒槽中的节点在下一个整分钟之后到期时，逐秒推进不能跳过整分钟的映射：
+ *   t=0 加 70 秒（分钟槽），t=50 加 20 秒（秒槽），两个都应在 t=70 执行，而不是分钟槽的那个晚一小时
+ */
+static int test_advance_remap() {
+    timer_st *T = clock_timer_create(TIMER_UNLOCKED);
+    int fail = 0;
+
+    sim = 0;
+    nfired = 0;
+    clock_timer_add(T, 70, record);
+    step(T, 50);
+    clock_timer_add(T, 20, record);
+    step(T, 3700);
+    if (nfired != 2 || fired_at[0] != 70 || fired_at[1] != 70) {
+        printf("FAIL advance_remap: fired %d timers at %u, %u, want 70, 70\n", nfired, fired_at[0], fired_at[1]);
+        fail++;
+    }
+    clock_timer_destroy(T);
+    return fail;
+}
+
+/*
+ * 稀疏的时间轮：前 30 天每 97 秒加 1 个定时器，延迟在 1~60 秒、1 秒~1 小时、1 秒~100 天中随机，
+ *   每 10 个删除 1 个，逐秒推进到全部到期，每个定时器都必须正好在期望的那一秒执行
+ *   大部分时间秒槽是空的，推进会跳过没有事件的秒
+ */
+static int test_random_deadlines() {
+    static const uint32_t ranges[] = {60, 3600, 100 * 86400};
+    timer_st *T = clock_timer_create(TIMER_UNLOCKED);
+    timer_node_t *node;
+    uint32_t seed = 2463534242u, d, end = 131 * 86400;
+    uint64_t added = 0, deleted = 0;
+    int fail = 0;
+
+    sim = 0;
+    checked = wrong = late_max = 0;
+    while (sim < end) {
+        if (sim < 30 * 86400 && sim % 97 == 0) {
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+            d = 1 + seed % ranges[seed % 3];
+            node = clock_timer_add(T, (int)d, check_deadline);
+            *deadline_of(node) = sim + d;
+            if (++added % 10 == 0) {
+                clock_timer_del(T, node);
+                deleted++;
+            }
+        }
+        step(T, 1);
+    }
+    if (wrong || checked != added - deleted) {
+        printf("FAIL random_deadlines: fired %lu of %lu, %lu not at their deadline, max late %lus\n",
+            checked, added - deleted, wrong, late_max);
+        fail++;
+    }
+    clock_timer_destroy(T);
+    return fail;
+}
+
+int main() {
+    int fail = 0;
+
+    fail += test_nearest_before_remap();
+    fail += test_fd_arm_before_remap();
+    fail += test_advance_remap();
+    fail += test_random_deadlines();
+    printf("%s\n", fail ? "FAILED" : "ok");
+    return fail != 0;
+}
+
+// gcc -O2 clock_timer_test.c clock_timer.c -lpthread -o ck_test
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mempool.h"
+#include "spinlock.h"
+
+#define MEM_POOL_HUGE_SIZE (2u << 20)
+
+typedef struct mem_obj_s {  // 空闲对象复用自身内存作为链表节点
+    struct mem_obj_s *next;
+} mem_obj_t;
+
+typedef struct mem_slab_s {
+    struct mem_slab_s *next;
+    size_t size;
+} mem_slab_t;
+
+struct mem_pool_s {
+    size_t obj_size;
+    size_t slab_size;
+    int flags;
+    int id;             // 线程本地缓存的下标
+    uint64_t gen;       // 区分复用同一下标的新旧对象池
+
+    spinlock_t lock;    // 保护以下字段
+    mem_obj_t *free_list;
+    mem_slab_t *slabs;
+    char *cur, *end;    // 当前 slab 中尚未切分的区域
+    uint64_t capacity;
+    uint64_t nslabs;
+    uint64_t slab_bytes;
+    int hugepage;
+
+    uint64_t in_use;     // 原子更新
+    uint64_t high_water;
+};
+
+typedef struct mem_cache_s {  // 线程本地空闲链表
+    mem_obj_t *head;
+    unsigned count;
+    uint64_t gen;
+} mem_cache_t;
+
+static mem_pool_t *pools[MEM_POOL_MAX];
+static uint64_t pool_gen;
+static spinlock_t pools_lock;
+static __thread mem_cache_t caches[MEM_POOL_MAX];
+
+
+static void* slab_map(mem_pool_t *pool, size_t *size) {
+    void *p;
+    if (pool->flags & MEM_POOL_HUGEPAGE) {
+        *size = (pool->slab_size + MEM_POOL_HUGE_SIZE - 1) & ~(size_t)(MEM_POOL_HUGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+        p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            pool->hugepage = 1;
+            return p;
+        }
+#endif
+        p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(p, *size, MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+    *size = pool->slab_size;
+    return malloc(*size);
+}
+
+
+static void slab_unmap(mem_pool_t *pool, mem_slab_t *slab) {
+    if (pool->flags & MEM_POOL_HUGEPAGE)
+        munmap(slab, slab->size);
+    else
+        free(slab);
+}
+
+
+static int slab_grow(mem_pool_t *pool) {  // 调用时已持有 pool->lock
+    size_t size;
+    mem_slab_t *slab = (mem_slab_t *)slab_map(pool, &size);
+    if (!slab)
+        return -1;
+
+    slab->size = size;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->cur = (char *)slab + ((sizeof(mem_slab_t) + 15) & ~(size_t)15);
+    pool->end = (char *)slab + size;
+    pool->capacity += (pool->end - pool->cur) / pool->obj_size;
+    pool->nslabs++;
+    pool->slab_bytes += size;
+    return 0;
+}
+
+
+mem_pool_t* mem_pool_create(size_t obj_size, size_t objs_per_slab, int flags) {
+    int i;
+    mem_pool_t *pool = (mem_pool_t *)malloc(sizeof(*pool));
+    if (!pool)
+        return NULL;
+    memset(pool, 0, sizeof(*pool));
+
+    if (obj_size < sizeof(mem_obj_t))
+        obj_size = sizeof(mem_obj_t);
+    pool->obj_size = (obj_size + 15) & ~(size_t)15;
+    pool->slab_size = ((sizeof(mem_slab_t) + 15) & ~(size_t)15) + pool->obj_size * (objs_per_slab ? objs_per_slab : 1024);
+    pool->flags = flags;
+    spinlock_init(&pool->lock);
+
+    spinlock_lock(&pools_lock);
+    for (i = 0; i < MEM_POOL_MAX && pools[i]; i++) {}
+    if (i == MEM_POOL_MAX) {
+        spinlock_unlock(&pools_lock);
+        free(pool);
+        return NULL;
+    }
+    pools[i] = pool;
+    pool->id = i;
+    pool->gen = ++pool_gen;
+    spinlock_unlock(&pools_lock);
+
+    return pool;
+}
+
+
+mem_pool_t* mem_pool_create_once(mem_pool_t **pool, size_t obj_size, size_t objs_per_slab, int flags) {  // 多个定时器实例共享一个对象池
+    mem_pool_t *p = __atomic_load_n(pool, __ATOMIC_ACQUIRE), *expected = NULL;
+    if (p)
+        return p;
+    p = mem_pool_create(obj_size, objs_per_slab, flags);
+    if (!p)
+        return __atomic_load_n(pool, __ATOMIC_ACQUIRE);
+    if (!__atomic_compare_exchange_n(pool, &expected, p, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        mem_pool_destroy(p);  // 其他线程已经创建
+        return expected;
+    }
+    return p;
+}
+
+
+void mem_pool_destroy(mem_pool_t *pool) {  // 所有对象随 slab 一起释放，其他线程的本地缓存依靠 gen 失效
+    mem_slab_t *slab = pool->slabs;
+    while (slab) {
+        mem_slab_t *next = slab->next;
+        slab_unmap(pool, slab);
+        slab = next;
+    }
+    spinlock_lock(&pools_lock);
+    pools[pool->id] = NULL;
+    spinlock_unlock(&pools_lock);
+    free(pool);
+}
+
+
+static void cache_refill(mem_pool_t *pool, mem_cache_t *c) {  // 从全局链表或 slab 取一批对象到本地链表
+    unsigned n = 0;
+    spinlock_lock(&pool->lock);
+    while (n < MEM_POOL_BATCH) {
+        mem_obj_t *obj = pool->free_list;
+        if (obj) {
+            pool->free_list = obj->next;
+        } else {
+            if (pool->cur + pool->obj_size > pool->end && (n || slab_grow(pool)))
+                break;
+            obj = (mem_obj_t *)pool->cur;
+            pool->cur += pool->obj_size;
+        }
+        obj->next = c->head;
+        c->head = obj;
+        n++;
+    }
+    spinlock_unlock(&pool->lock);
+    c->count += n;
+}
+
+
+static void cache_drain(mem_pool_t *pool, mem_cache_t *c, unsigned n) {  // 把本地链表中的 n 个对象还给全局链表
+    mem_obj_t *first = c->head, *last = first;
+    unsigned i;
+    for (i = 1; i < n; i++)
+        last = last->next;
+    c->head = last->next;
+    c->count -= n;
+
+    spinlock_lock(&pool->lock);
+    last->next = pool->free_list;
+    pool->free_list = first;
+    spinlock_unlock(&pool->lock);
+}
+
+
+static inline mem_cache_t* cache_of(mem_pool_t *pool) {
+    mem_cache_t *c = &caches[pool->id];
+    if (c->gen != pool->gen) {  // 第一次使用，或者之前的对象池已销毁
+        c->head = NULL;
+        c->count = 0;
+        c->gen = pool->gen;
+    }
+    return c;
+}
+
+
+static inline void pool_used_add(mem_pool_t *pool, uint64_t n) {
+    uint64_t used, hw;
+    used = __atomic_add_fetch(&pool->in_use, n, __ATOMIC_RELAXED);
+    hw = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    while (used > hw && !__atomic_compare_exchange_n(&pool->high_water, &hw, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+
+void* mem_pool_alloc(mem_pool_t *pool) {
+    mem_cache_t *c = cache_of(pool);
+    mem_obj_t *obj;
+
+    if (!c->head) {
+        cache_refill(pool, c);
+        if (!c->head)
+            return NULL;
+    }
+    obj = c->head;
+    c->head = obj->next;
+    c->count--;
+
+    pool_used_add(pool, 1);
+
+    return obj;
+}
+
+
+unsigned mem_pool_alloc_bulk(mem_pool_t *pool, void **objs, unsigned n) {  // 先取本地链表，不够的部分只加一次锁直接从全局链表和 slab 取
+    mem_cache_t *c = cache_of(pool);
+    mem_obj_t *obj;
+    unsigned i = 0;
+
+    while (i < n && c->head) {
+        obj = c->head;
+        c->head = obj->next;
+        c->count--;
+        objs[i++] = obj;
+    }
+    if (i < n) {
+        spinlock_lock(&pool->lock);
+        while (i < n) {
+            obj = pool->free_list;
+            if (obj) {
+                pool->free_list = obj->next;
+            } else {
+                if (pool->cur + pool->obj_size > pool->end && slab_grow(pool))
+                    break;
+                obj = (mem_obj_t *)pool->cur;
+                pool->cur += pool->obj_size;
+            }
+            objs[i++] = obj;
+        }
+        spinlock_unlock(&pool->lock);
+    }
+
+    if (i)
+        pool_used_add(pool, i);
+    return i;
+}
+
+
+void mem_pool_free(mem_pool_t *pool, void *p) {
+    mem_cache_t *c;
+    mem_obj_t *obj = (mem_obj_t *)p;
+    if (!obj)
+        return;
+
+    c = cache_of(pool);
+    obj->next = c->head;
+    c->head = obj;
+    c->count++;
+    __atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+
+    if (c->count > 2 * MEM_POOL_BATCH)
+        cache_drain(pool, c, MEM_POOL_BATCH);
+}
+
+
+void mem_pool_stats(mem_pool_t *pool, mem_pool_stats_t *st) {
+    spinlock_lock(&pool->lock);
+    st->obj_size = pool->obj_size;
+    st->capacity = pool->capacity;
+    st->slabs = pool->nslabs;
+    st->slab_bytes = pool->slab_bytes;
+    st->hugepage = pool->hugepage;
+    spinlock_unlock(&pool->lock);
+    st->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+    st->high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,70 @@
+#ifndef MARK_MEMPOOL_H
+#define MARK_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 定长对象池，供各个定时器后端分配 timer_entry_t / timer_node_t
+ *   对象从 slab 中切分，释放后挂到空闲链表上复用，不归还给系统
+ *   每个线程有一个本地空闲链表，分配/释放一般不加锁；
+ *   本地链表为空或过长时，才以 MEM_POOL_BATCH 为单位和全局空闲链表交换
+ *   MEM_POOL_HUGEPAGE：slab 优先使用 2MB 大页，失败则退化为普通页 + MADV_HUGEPAGE
+ */
+
+#define MEM_POOL_HUGEPAGE 0x1
+
+#define MEM_POOL_MAX   16  // 进程内同时存在的对象池个数上限
+#define MEM_POOL_BATCH 64  // 线程本地链表与全局链表每次交换的对象个数
+
+typedef struct mem_pool_s mem_pool_t;
+
+typedef struct mem_pool_stats_s {
+    size_t obj_size;       // 对象大小（已按 16 字节对齐）
+    uint64_t in_use;       // 已分配出去的对象个数
+    uint64_t high_water;   // in_use 的历史最大值
+    uint64_t capacity;     // 所有 slab 能容纳的对象个数
+    uint64_t slabs;        // slab 个数
+    uint64_t slab_bytes;   // slab 占用的总内存
+    int hugepage;          // slab 是否使用了大页
+} mem_pool_stats_t;
+
+/*
+ * 各定时器后端通过以下两个宏分配/释放节点：
+ *   编译时定义 TIMER_USE_POOL 则使用对象池（需要链接 mempool.c），否则直接 malloc / free
+ *   TIMER_POOL_FLAGS 为创建对象池的标志，如 -DTIMER_POOL_FLAGS=MEM_POOL_HUGEPAGE
+ */
+#ifdef TIMER_USE_POOL
+#define timer_pool_alloc(pool, type)  ((type *)mem_pool_alloc(pool))
+#define timer_pool_free(pool, p)      mem_pool_free(pool, p)
+#define timer_pool_alloc_bulk(pool, objs, n)  mem_pool_alloc_bulk(pool, (void **)(objs), n)
+#else
+#define timer_pool_alloc(pool, type)  ((type *)malloc(sizeof(type)))
+#define timer_pool_free(pool, p)      free(p)
+#define timer_pool_alloc_bulk(pool, objs, n)  timer_malloc_bulk((void **)(objs), n, sizeof(**(objs)))
+
+#include <stdlib.h>
+static inline unsigned timer_malloc_bulk(void **objs, unsigned n, size_t size) {
+    unsigned i;
+    for (i = 0; i < n; i++)
+        if ((objs[i] = malloc(size)) == NULL)
+            break;
+    return i;
+}
+#endif
+
+#ifndef TIMER_POOL_FLAGS
+#define TIMER_POOL_FLAGS 0
+#endif
+
+#define TIMER_POOL_SLAB 4096  // 每个 slab 容纳的节点个数
+
+mem_pool_t* mem_pool_create(size_t obj_size, size_t objs_per_slab, int flags);
+mem_pool_t* mem_pool_create_once(mem_pool_t **pool, size_t obj_size, size_t objs_per_slab, int flags); // *pool 为空时创建，多线程同时调用只会留下一个
+void        mem_pool_destroy(mem_pool_t *pool);
+void*       mem_pool_alloc(mem_pool_t *pool);
+unsigned    mem_pool_alloc_bulk(mem_pool_t *pool, void **objs, unsigned n); // 一次取 n 个对象，返回实际取到的个数
+void        mem_pool_free(mem_pool_t *pool, void *obj);
+void        mem_pool_stats(mem_pool_t *pool, mem_pool_stats_t *st);
+
+#endif // MARK_MEMPOOL_H
@@ -1,135 +1,345 @@
-#include "minheap.h"
-
-#define min_heap_elem_greater(a, b) \
-    ((a)->time > (b)->time)
-
-
-void min_heap_ctor_(min_heap_t *s) { s->p = 0; s->n = 0; s->a = 0; }
-void min_heap_dtor_(min_heap_t *s) { if (s->p) free(s->p); }
-void min_heap_elem_init_(timer_entry_t* e) { e->min_heap_idx = -1; }
-int min_heap_empty_(min_heap_t* s) { return 0u == s->n; }
-unsigned min_heap_size_(min_heap_t* s) { return s->n; }
-timer_entry_t* min_heap_top_(min_heap_t* s) { return s->n ? *s->p : 0; }
-
-
-int min_heap_push_(min_heap_t *s, timer_entry_t *e) {
-
-    if (min_heap_reserve_(s, s->n + 1))
-        return -1;
-    min_heap_shift_up_(s, s->n++, e);
-    return 0;
-}
-
-
-timer_entry_t* min_heap_pop(min_heap_t* s) {
-
-    if (s->n) {
-        timer_entry_t *e = *s->p;
-        min_heap_shift_down_(s, 0u, s->p[--s->n]);
-        e->min_heap_idx = -1;
-
-        return e;
-    }
-    return 0;
-}
-
-
-int min_heap_elt_is_top_(const timer_entry_t *e)
-{
-    return e->min_heap_idx == 0;
-}
-
-
-int min_heap_erase_(min_heap_t *s, timer_entry_t* e) {
-
-    if (-1 != e->min_heap_idx) {
-        timer_entry_t *last = s->p[--s->n];
-        unsigned parent = (e->min_heap_idx - 1) / 2;
-
-        if (e->min_heap_idx > 0 && min_heap_elem_greater(s->p[parent], last))
-            min_heap_shift_up_unconditional_(s, e->min_heap_idx, last);
-        else    
-            min_heap_shift_down_(s, e->min_heap_idx, last);
-        e->min_heap_idx = -1;
-        return 0;
-    }
-    return -1;
-}
-
-
-int min_heap_adjust_(min_heap_t *s, timer_entry_t *e) {
-    
-    if (-1 == e->min_heap_idx) {
-        return min_heap_push_(s, e);
-    } else {
-        unsigned parent = (e->min_heap_idx - 1) / 2;
-
-        if (e->min_heap_idx > 0 &&min_heap_elem_greater(s->p[parent], e))
-            min_heap_shift_up_unconditional_(s, e->min_heap_idx, e);
-        else    
-            min_heap_shift_down_(s, e->min_heap_idx, e);
-        return 0;
-    }
-}
-
-
-int min_heap_reserve_(min_heap_t* s, unsigned n) {
-
-    if (s->a < n) {
-        timer_entry_t **p;
-        unsigned a = s->a ? s->a * 2 : 8;
-        if (a < n)
-            a = n;
-        if (!(p = (timer_entry_t **)realloc(s->p, a * sizeof *p)))
-            return -1;
-
-        s->p = p;
-        s->a = a;
-    }
-    return 0;
-}
-
-
-void min_heap_shift_up_unconditional_(min_heap_t *s, unsigned hole_index, timer_entry_t *e) {
-
-    unsigned parent = (hole_index - 1) / 2;
-    do {
-        (s->p[hole_index] = s->p[parent])->min_heap_idx = hole_index;
-        hole_index = parent;
-        parent = (hole_index - 1) / 2;
-    }
-    while (hole_index && min_heap_elem_greater(s->p[parent], e));
-
-    (s->p[hole_index] = e)->min_heap_idx = hole_index;
-}
-
-
-void min_heap_shift_up_(min_heap_t *s, unsigned hole_index, timer_entry_t* e) {
-
-    unsigned parent = (hole_index - 1) / 2;
-    while (hole_index && min_heap_elem_greater(s->p[parent], e)) {
-        (s->p[hole_index] = s->p[parent])->min_heap_idx = hole_index;
-        hole_index = parent;
-        parent = (hole_index - 1) / 2;
-    }
-
-    (s->p[hole_index] = e)->min_heap_idx = hole_index;
-}
-
-
-void min_heap_shift_down_(min_heap_t *s, unsigned hole_index, timer_entry_t *e) {
-
-    unsigned min_child = 2 * (hole_index + 1);
-    while (min_child <= s->n) {
-        min_child -= min_child == s->n || min_heap_elem_greater(s->p[min_child], s->p[min_child - 1]);
-        if (!(min_heap_elem_greater(e, s->p[min_child])))
-            break;
-        (s->p[hole_index] = s->p[min_child])->min_heap_idx = hole_index;
-        hole_index = min_child;
-        min_child = 2 * (hole_index + 1);
-    }
-
-    (s->p[hole_index] = e)->min_heap_idx = hole_index;
-}
-
-
+#include <string.h>
+
+#include "minheap.h"
+
+#if defined(__SSE4_1__) && MIN_HEAP_ARITY >= 4
+#include <smmintrin.h>
+#define MIN_HEAP_USE_SIMD 1
+#endif
+
+#define min_heap_elem_greater(a, b) \
+    ((a)->time > (b)->time)
+
+#define min_heap_parent(i)      (((i) - 1) / MIN_HEAP_ARITY)
+#define min_heap_first_child(i) (MIN_HEAP_ARITY * (i) + 1)
+
+static inline void min_heap_shift_up_slot_(min_heap_t *s, unsigned hole_index, min_heap_slot_t x);
+static inline void min_heap_shift_down_slot_(min_heap_t *s, unsigned hole_index, min_heap_slot_t x);
+
+
+void min_heap_ctor_(min_heap_t *s) { s->p = 0; s->n = 0; s->a = 0; }
+void min_heap_dtor_(min_heap_t *s) { if (s->p) free(s->p - (MIN_HEAP_ARITY - 1)); }
+void min_heap_elem_init_(timer_entry_t* e) { e->min_heap_idx = -1; }
+int min_heap_empty_(min_heap_t* s) { return 0u == s->n; }
+unsigned min_heap_size_(min_heap_t* s) { return s->n; }
+timer_entry_t* min_heap_top_(min_heap_t* s) { return s->n ? s->p->e : 0; }
+
+
+int min_heap_push_(min_heap_t *s, timer_entry_t *e) {
+
+    if (min_heap_reserve_(s, s->n + 1))
+        return -1;
+    min_heap_shift_up_(s, s->n++, e);
+    return 0;
+}
+
+
+int min_heap_push_batch_(min_heap_t *s, timer_entry_t **e, unsigned n) {
+
+    unsigned i;
+    if (min_heap_reserve_(s, s->n + n))
+        return -1;
+
+    if (n < (uint64_t)s->n * MIN_HEAP_HEAPIFY_RATIO) {
+        for (i = 0; i < n; i++)
+            min_heap_shift_up_(s, s->n++, e[i]);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        s->p[s->n].time = e[i]->time;
+        s->p[s->n].e = e[i];
+        s->n++;
+    }
+    min_heap_heapify_(s);
+    return 0;
+}
+
+
+void min_heap_heapify_(min_heap_t *s) {  // Floyd 建堆：从最后一个非叶子节点开始依次 shift_down
+
+    unsigned i;
+    if (s->n < 2) {
+        if (s->n)
+            s->p->e->min_heap_idx = 0;
+        return;
+    }
+    // 叶子节点不会被 shift_down 移动，先统一写好它们的 min_heap_idx
+    for (i = min_heap_parent(s->n - 1) + 1; i < s->n; i++)
+        s->p[i].e->min_heap_idx = i;
+    i = min_heap_parent(s->n - 1) + 1;
+    while (i--)
+        min_heap_shift_down_slot_(s, i, s->p[i]);
+}
+
+
+timer_entry_t* min_heap_pop_(min_heap_t* s) {
+
+    if (s->n) {
+        timer_entry_t *e = s->p->e;
+        --s->n;
+        min_heap_shift_down_slot_(s, 0u, s->p[s->n]);
+        e->min_heap_idx = -1;
+
+        return e;
+    }
+    return 0;
+}
+
+
+static int min_heap_entry_cmp_(const void *a, const void *b) {
+
+    uint32_t ta = (*(timer_entry_t * const *)a)->time;
+    uint32_t tb = (*(timer_entry_t * const *)b)->time;
+    return ta < tb ? -1 : ta > tb;
+}
+
+
+/*
+ * 一次取出所有 time <= 给定时间的元素，按 time 升序写入 out，返回个数
+ * out 最多写入 cap 个：到期的元素多于 cap 个时只逐个 pop 出最早的 cap 个，返回 cap
+ *   满足条件的元素在堆顶构成一棵连通子树，先广度遍历得到个数 k：
+ *   k 较小时逐个 pop，k 次 shift_down；
+ *   k 较大时把剩余元素压缩到数组前部再 O(n) 建堆，不做任何 shift_down
+ */
+unsigned min_heap_pop_until_(min_heap_t *s, uint32_t time, timer_entry_t **out, unsigned cap) {
+
+    unsigned i, j, q, k = 0, depth = 0;
+    if (!cap || !s->n || s->p->time > time)
+        return 0;
+
+    out[k++] = s->p->e;
+    for (q = 0; q < k; q++) {
+        unsigned first = min_heap_first_child(out[q]->min_heap_idx);
+        unsigned last = first + MIN_HEAP_ARITY;
+        if (last > s->n)
+            last = s->n;
+        for (i = first; i < last; i++) {
+            if (s->p[i].time <= time) {
+                if (k == cap)
+                    goto partial;
+                out[k++] = s->p[i].e;
+            }
+        }
+    }
+
+    for (i = s->n; i; i /= MIN_HEAP_ARITY)
+        depth++;
+    if ((uint64_t)k * depth * MIN_HEAP_ARITY < s->n) {
+        for (i = 0; i < k; i++)
+            out[i] = min_heap_pop_(s);
+        return k;
+    }
+
+    for (i = 0, j = 0; i < s->n; i++) {
+        if (s->p[i].time > time)
+            s->p[j++] = s->p[i];
+    }
+    s->n = j;
+    min_heap_heapify_(s);
+
+    for (i = 0; i < k; i++)
+        out[i]->min_heap_idx = -1;
+    qsort(out, k, sizeof(*out), min_heap_entry_cmp_);
+    return k;
+
+partial:
+    for (i = 0; i < cap; i++)
+        out[i] = min_heap_pop_(s);
+    return cap;
+}
+
+
+/*
+ * 删除所有 pred 返回非 0 的元素，剩余元素 O(n) 重新建堆，返回删除个数
+ * 被删除元素的 min_heap_idx 在调用 pred 之前置为 -1，pred 中可以直接释放它
+ */
+unsigned min_heap_remove_if_(min_heap_t *s, int (*pred)(timer_entry_t *e, void *arg), void *arg) {
+
+    unsigned i, j;
+    for (i = 0, j = 0; i < s->n; i++) {
+        timer_entry_t *e = s->p[i].e;
+        uint32_t idx = e->min_heap_idx;
+        e->min_heap_idx = -1;
+        if (pred(e, arg))
+            continue;
+        e->min_heap_idx = idx;
+        s->p[j++] = s->p[i];
+    }
+    i = s->n - j;
+    s->n = j;
+    if (i)
+        min_heap_heapify_(s);
+    return i;
+}
+
+
+int min_heap_elt_is_top_(const timer_entry_t *e)
+{
+    return e->min_heap_idx == 0;
+}
+
+
+int min_heap_erase_(min_heap_t *s, timer_entry_t* e) {
+
+    if (-1 != e->min_heap_idx) {
+        min_heap_slot_t last = s->p[--s->n];
+        unsigned parent = min_heap_parent(e->min_heap_idx);
+
+        if (e->min_heap_idx > 0 && min_heap_elem_greater(&s->p[parent], &last))
+            min_heap_shift_up_slot_(s, e->min_heap_idx, last);
+        else    
+            min_heap_shift_down_slot_(s, e->min_heap_idx, last);
+        e->min_heap_idx = -1;
+        return 0;
+    }
+    return -1;
+}
+
+
+int min_heap_adjust_(min_heap_t *s, timer_entry_t *e) {
+    
+    if (-1 == e->min_heap_idx) {
+        return min_heap_push_(s, e);
+    } else {
+        unsigned parent = min_heap_parent(e->min_heap_idx);
+
+        if (e->min_heap_idx > 0 &&min_heap_elem_greater(&s->p[parent], e))
+            min_heap_shift_up_unconditional_(s, e->min_heap_idx, e);
+        else    
+            min_heap_shift_down_(s, e->min_heap_idx, e);
+        return 0;
+    }
+}
+
+
+int min_heap_reserve_(min_heap_t* s, unsigned n) {
+
+    if (s->a < n) {
+        min_heap_slot_t *p;
+        void *base;
+        unsigned a = s->a ? s->a * 2 : 8;
+        if (a < n)
+            a = n;
+        // 多分配 MIN_HEAP_ARITY-1 个槽位：p[i] 的子节点从 p[MIN_HEAP_ARITY*i+1] 开始，
+        // 偏移后恰好落在 MIN_HEAP_ARITY 的整数倍上，整组兄弟节点不会跨 cache line
+        if (posix_memalign(&base, MIN_HEAP_ALIGN, (a + MIN_HEAP_ARITY - 1) * sizeof *p))
+            return -1;
+
+        p = (min_heap_slot_t *)base + (MIN_HEAP_ARITY - 1);
+        if (s->p) {
+            memcpy(p, s->p, s->n * sizeof *p);
+            free(s->p - (MIN_HEAP_ARITY - 1));
+        }
+        s->p = p;
+        s->a = a;
+    }
+    return 0;
+}
+
+
+void min_heap_shift_up_unconditional_(min_heap_t *s, unsigned hole_index, timer_entry_t *e) {
+
+    unsigned parent = min_heap_parent(hole_index);
+    do {
+        s->p[hole_index] = s->p[parent];
+        s->p[hole_index].e->min_heap_idx = hole_index;
+        hole_index = parent;
+        parent = min_heap_parent(hole_index);
+    }
+    while (hole_index && min_heap_elem_greater(&s->p[parent], e));
+
+    s->p[hole_index].time = e->time;
+    (s->p[hole_index].e = e)->min_heap_idx = hole_index;
+}
+
+
+static inline void min_heap_shift_up_slot_(min_heap_t *s, unsigned hole_index, min_heap_slot_t x) {
+
+    unsigned parent = min_heap_parent(hole_index);
+    while (hole_index && min_heap_elem_greater(&s->p[parent], &x)) {
+        s->p[hole_index] = s->p[parent];
+        s->p[hole_index].e->min_heap_idx = hole_index;
+        hole_index = parent;
+        parent = min_heap_parent(hole_index);
+    }
+
+    s->p[hole_index] = x;
+    x.e->min_heap_idx = hole_index;
+}
+
+
+void min_heap_shift_up_(min_heap_t *s, unsigned hole_index, timer_entry_t* e) {
+
+    min_heap_slot_t x = { e->time, e };
+    min_heap_shift_up_slot_(s, hole_index, x);
+}
+
+
+#ifdef MIN_HEAP_USE_SIMD
+// 一组完整的兄弟节点：用 SSE4.1 求 MIN_HEAP_ARITY 个 key 的最小值，再用比较掩码找出它的位置
+static inline unsigned min_heap_min_of_group_(const min_heap_slot_t *c) {
+
+    __m128i lo = _mm_set_epi32(c[3].time, c[2].time, c[1].time, c[0].time);
+    __m128i m = lo;
+#if MIN_HEAP_ARITY == 8
+    __m128i hi = _mm_set_epi32(c[7].time, c[6].time, c[5].time, c[4].time);
+    m = _mm_min_epu32(m, hi);
+#endif
+    m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, m)));
+#if MIN_HEAP_ARITY == 8
+    mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, m))) << 4;
+#endif
+    return __builtin_ctz(mask);
+}
+#endif
+
+
+// 返回 [first, first+MIN_HEAP_ARITY) 中 time 最小的子节点下标，first 必须 < s->n
+static inline unsigned min_heap_min_child_(min_heap_t *s, unsigned first) {
+
+    unsigned i, min_child = first;
+    unsigned last = first + MIN_HEAP_ARITY;
+
+#ifdef MIN_HEAP_USE_SIMD
+    if (last <= s->n)
+        return first + min_heap_min_of_group_(s->p + first);
+#endif
+    if (last > s->n)
+        last = s->n;
+    for (i = first + 1; i < last; i++) {
+        if (min_heap_elem_greater(&s->p[min_child], &s->p[i]))
+            min_child = i;
+    }
+    return min_child;
+}
+
+
+static inline void min_heap_shift_down_slot_(min_heap_t *s, unsigned hole_index, min_heap_slot_t x) {
+
+    unsigned min_child = min_heap_first_child(hole_index);
+    while (min_child < s->n) {
+        min_child = min_heap_min_child_(s, min_child);
+        if (!(min_heap_elem_greater(&x, &s->p[min_child])))
+            break;
+        s->p[hole_index] = s->p[min_child];
+        s->p[hole_index].e->min_heap_idx = hole_index;
+        hole_index = min_child;
+        min_child = min_heap_first_child(hole_index);
+    }
+
+    s->p[hole_index] = x;
+    x.e->min_heap_idx = hole_index;
+}
+
+
+void min_heap_shift_down_(min_heap_t *s, unsigned hole_index, timer_entry_t *e) {
+
+    min_heap_slot_t x = { e->time, e };
+    min_heap_shift_down_slot_(s, hole_index, x);
+}
+
+
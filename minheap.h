@@ -1,38 +1,81 @@
-#ifndef MARK_MINHEAP_H
-#define MARK_MINHEAP_H
-
-#include <stdint.h>
-#include <stdlib.h>
-
-typedef struct timer_entry_s timer_entry_t;
-typedef void (*timer_handler_pt)(timer_entry_t *ev);
-
-struct timer_entry_s {
-    uint32_t time;
-    uint32_t min_heap_idx;
-    timer_handler_pt handler;
-    void *privdata;
-};
-
-typedef struct min_heap {
-    timer_entry_t **p;
-    uint32_t n, a; // n 为实际元素个数  a 为容量
-} min_heap_t;
-
-void            min_heap_ctor_(min_heap_t* s);
-void            min_heap_dtor_(min_heap_t* s);
-void            min_heap_elem_init_(timer_entry_t* e);
-int             min_heap_elt_is_top_(const timer_entry_t *e);
-int             min_heap_empty_(min_heap_t* s);
-unsigned        min_heap_size_(min_heap_t* s);
-timer_entry_t*  min_heap_top_(min_heap_t* s);
-int             min_heap_reserve_(min_heap_t* s, unsigned n);
-int             min_heap_push_(min_heap_t* s, timer_entry_t* e);
-timer_entry_t*  min_heap_pop_(min_heap_t* s);
-int             min_heap_adjust_(min_heap_t *s, timer_entry_t* e);
-int             min_heap_erase_(min_heap_t* s, timer_entry_t* e);
-void            min_heap_shift_up_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
-void            min_heap_shift_up_unconditional_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
-void            min_heap_shift_down_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
-
-#endif // MARK_MINHEAP_H
\ No newline at end of file
+#ifndef MARK_MINHEAP_H
+#define MARK_MINHEAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * 堆的叉数（每个节点的子节点个数），编译期确定，可选 2 / 4 / 8
+ *   2 即原来的二叉堆；4 / 8 叉堆的高度更低，pop 时依赖的 cache miss 更少
+ *   一组兄弟节点在数组中按 cache line 对齐存放，shift_down 一次比较整组子节点
+ *   gcc -DMIN_HEAP_ARITY=8 ...
+ */
+#ifndef MIN_HEAP_ARITY
+#define MIN_HEAP_ARITY 4
+#endif
+
+#if MIN_HEAP_ARITY != 2 && MIN_HEAP_ARITY != 4 && MIN_HEAP_ARITY != 8
+#error "MIN_HEAP_ARITY must be 2, 4 or 8"
+#endif
+
+#define MIN_HEAP_ALIGN 64 // cache line 大小
+
+/*
+ * 批量插入 k 个元素时，若 k >= 原有元素个数 * MIN_HEAP_HEAPIFY_RATIO，
+ * 则直接追加到数组末尾并用 Floyd 自底向上建堆 O(n+k)，否则逐个 shift_up
+ * minheap_bench.c（每个点取 5 次中的最小值）：shift_up 平均只上移一两层，新 key 全部早于原有的也一样，
+ *   原有 25 万个元素时 k 到 64 倍仍是 shift_up 快；原有 2000 个、堆还在 cache 中时 4 叉堆在 k 约 64 倍处 heapify 领先，
+ *   从空堆建堆时 heapify 始终更快（降序 key 的二叉堆快一倍多），故默认取 64
+ */
+#ifndef MIN_HEAP_HEAPIFY_RATIO
+#define MIN_HEAP_HEAPIFY_RATIO 64
+#endif
+
+typedef struct timer_entry_s timer_entry_t;
+typedef void (*timer_handler_pt)(timer_entry_t *ev);
+
+struct timer_entry_s {
+    uint32_t time;
+    uint32_t min_heap_idx;
+    timer_handler_pt handler;
+    void *privdata;
+    uint32_t interval; // 周期定时器的间隔，0 表示一次性定时器
+    uint8_t mode;      // 周期定时器的重新调度方式
+};
+
+/*
+ * 堆数组中直接存放 {time, entry}，比较时只访问连续的数组，
+ * 只有在更新 min_heap_idx 时才会解引用 entry
+ * 修改 entry->time 之后必须调用 min_heap_adjust_ 同步数组中的 key
+ */
+typedef struct min_heap_slot {
+    uint32_t time;
+    timer_entry_t *e;
+} min_heap_slot_t;
+
+typedef struct min_heap {
+    min_heap_slot_t *p; // p[0] 为堆顶，p 前面预留 MIN_HEAP_ARITY-1 个槽位，使每组兄弟节点从对齐地址开始
+    uint32_t n, a; // n 为实际元素个数  a 为容量
+} min_heap_t;
+
+void            min_heap_ctor_(min_heap_t* s);
+void            min_heap_dtor_(min_heap_t* s);
+void            min_heap_elem_init_(timer_entry_t* e);
+int             min_heap_elt_is_top_(const timer_entry_t *e);
+int             min_heap_empty_(min_heap_t* s);
+unsigned        min_heap_size_(min_heap_t* s);
+timer_entry_t*  min_heap_top_(min_heap_t* s);
+int             min_heap_reserve_(min_heap_t* s, unsigned n);
+int             min_heap_push_(min_heap_t* s, timer_entry_t* e);
+int             min_heap_push_batch_(min_heap_t* s, timer_entry_t** e, unsigned n);
+void            min_heap_heapify_(min_heap_t* s);
+timer_entry_t*  min_heap_pop_(min_heap_t* s);
+unsigned        min_heap_pop_until_(min_heap_t* s, uint32_t time, timer_entry_t** out, unsigned cap);
+unsigned        min_heap_remove_if_(min_heap_t* s, int (*pred)(timer_entry_t* e, void* arg), void* arg);
+int             min_heap_adjust_(min_heap_t *s, timer_entry_t* e);
+int             min_heap_erase_(min_heap_t* s, timer_entry_t* e);
+void            min_heap_shift_up_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
+void            min_heap_shift_up_unconditional_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
+void            min_heap_shift_down_(min_heap_t* s, unsigned hole_index, timer_entry_t* e);
+
+#endif // MARK_MINHEAP_H
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "minheap.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t rnd_state = 2463534242u;
+static uint32_t rnd() {  // xorshift32
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/*
+ * 批量插入的分界点：堆中已有 base 个元素，再插入 k 个
+ *   sift-up：逐个 min_heap_push_
+ *   heapify：追加到数组末尾后 min_heap_heapify_
+ *   每个点重复 BATCH_REPEAT 次取最小值，单次的噪声足以让相近的两个结果颠倒
+ *   random：新元素与原有元素同分布，shift_up 平均只上移一两层
+ *   early：新元素全部早于原有元素（一小时的定时器中加入一批一秒内的），shift_up 每次几乎走到堆顶
+ */
+#define BATCH_REPEAT 5
+
+static void bench_batch(unsigned base, int early) {
+    static const unsigned ratio[] = { 1, 4, 16, 64, 256, 1024 };  // k = base * ratio / 16
+    unsigned r, i, mode, rep;
+
+    for (r = 0; r < sizeof(ratio) / sizeof(ratio[0]); r++) {
+        unsigned k = (unsigned)((uint64_t)base * ratio[r] / 16);
+        double cost[2] = { 0, 0 };
+        for (rep = 0; rep < BATCH_REPEAT; rep++)
+        for (mode = 0; mode < 2; mode++) {
+            min_heap_t heap;
+            timer_entry_t *entries = (timer_entry_t *)calloc(base + k, sizeof(*entries));
+            timer_entry_t **batch = (timer_entry_t **)malloc(k * sizeof(*batch));
+            uint64_t t0, t1;
+
+            min_heap_ctor_(&heap);
+            for (i = 0; i < base + k; i++)
+                entries[i].time = early && i >= base ? rnd() % 1000 : 1000 + rnd() % 3600000;
+            for (i = 0; i < base; i++)
+                min_heap_push_(&heap, &entries[i]);
+            for (i = 0; i < k; i++)
+                batch[i] = &entries[base + i];
+            min_heap_reserve_(&heap, base + k);
+
+            t0 = now_ns();
+            if (mode == 0) {
+                for (i = 0; i < k; i++)
+                    min_heap_shift_up_(&heap, heap.n++, batch[i]);
+            } else {
+                for (i = 0; i < k; i++) {
+                    heap.p[heap.n].time = batch[i]->time;
+                    heap.p[heap.n++].e = batch[i];
+                }
+                min_heap_heapify_(&heap);
+            }
+            t1 = now_ns();
+            if (rep == 0 || (double)(t1 - t0) / k < cost[mode])
+                cost[mode] = (double)(t1 - t0) / k;
+
+            min_heap_dtor_(&heap);
+            free(batch);
+            free(entries);
+        }
+        printf("batch %-6s base=%u k=%u sift-up=%.1fns heapify=%.1fns per element\n",
+            early ? "early" : "random", base, k, cost[0], cost[1]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 2000000;
+    unsigned i;
+    uint64_t t0, t1, t2, t3;
+    min_heap_t heap;
+    timer_entry_t *entries = (timer_entry_t *)calloc(n, sizeof(*entries));
+    timer_entry_t **order = (timer_entry_t **)malloc(n * sizeof(*order));
+
+    min_heap_ctor_(&heap);
+    for (i = 0; i < n; i++) {
+        entries[i].time = rnd() % 3600000;  // 一小时内的超时时间
+        min_heap_elem_init_(&entries[i]);
+        order[i] = &entries[i];
+    }
+    for (i = n - 1; i > 0; i--) {  // 打乱 malloc 顺序带来的局部性
+        unsigned j = rnd() % (i + 1);
+        timer_entry_t *t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        min_heap_push_(&heap, order[i]);
+    t1 = now_ns();
+    for (i = 0; i < n / 2; i++) {  // 删除一半，再重新调整剩下的一半
+        min_heap_erase_(&heap, order[i]);
+    }
+    for (i = n / 2; i < n; i++) {
+        order[i]->time = rnd() % 3600000;
+        min_heap_adjust_(&heap, order[i]);
+    }
+    t2 = now_ns();
+    uint32_t last = 0;
+    while (!min_heap_empty_(&heap)) {
+        timer_entry_t *e = min_heap_pop_(&heap);
+        if (e->time < last) {
+            printf("heap order broken\n");
+            return 1;
+        }
+        last = e->time;
+    }
+    t3 = now_ns();
+
+    printf("arity=%d n=%u push=%.1fns erase+adjust=%.1fns pop=%.1fns\n",
+        MIN_HEAP_ARITY, n,
+        (double)(t1 - t0) / n, (double)(t2 - t1) / n, (double)(t3 - t2) / (n - n / 2));
+
+    min_heap_dtor_(&heap);
+    free(order);
+    free(entries);
+
+    bench_batch(n / 8, 0);
+    bench_batch(n / 8, 1);
+    return 0;
+}
+
+// gcc -O2 -msse4.1 -DMIN_HEAP_ARITY=2 minheap_bench.c minheap.c -o mh_bench2
+// gcc -O2 -msse4.1 -DMIN_HEAP_ARITY=4 minheap_bench.c minheap.c -o mh_bench4
+// gcc -O2 -msse4.1 -DMIN_HEAP_ARITY=8 minheap_bench.c minheap.c -o mh_bench8
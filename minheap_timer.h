@@ -1,85 +1,359 @@
-#ifndef MARK_MINHEAP_TIMER_H
-#define MARK_MINHEAP_TIMER_H
-
-#if defined(__APPLE__)
-#include <AvailabilityMacros.h>
-#include <sys/time.h>
-#include <mach/task.h>
-#include <mach/mach.h>
-#else
-#include <time.h>
-#endif
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <stdbool.h>
-#include <stdint.h>
-
-#include "minheap.h"
-
-static min_heap_t min_heap;
-
-static uint32_t
-current_time() {
-	uint32_t t;
-#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
-	struct timespec ti;
-	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint32_t)ti.tv_sec * 1000;
-	t += ti.tv_nsec / 1000000;
-#else
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	t = (uint32_t)tv.tv_sec * 1000;
-	t += tv.tv_usec / 1000;
-#endif
-	return t;
-}
-
-void init_timer() {
-    min_heap_ctor_(&min_heap);
-}
-
-timer_entry_t * add_timer(uint32_t msec, timer_handler_pt callback) {
-    timer_entry_t *te = (timer_entry_t *)malloc(sizeof(*te));
-    if (!te) {
-        return NULL;
-    }
-    memset(te, 0, sizeof(timer_entry_t));
-
-    te->handler = callback;
-    te->time = current_time() + msec;
-
-    if (0 != min_heap_push_(&min_heap, te)) {
-        free(te);
-        return NULL;
-    }
-    printf("add timer time = %u now = %u\n", te->time, current_time());
-    return te;
-}
-
-bool del_timer(timer_entry_t *e) {
-    return 0 == min_heap_erase_(&min_heap, e);
-}
-
-int find_nearest_expire_timer() {
-    timer_entry_t *te = min_heap_top_(&min_heap);
-    if (!te) return -1;
-    int diff = (int) te->time - (int)current_time();
-    return diff > 0 ? diff : 0;
-}
-
-void expire_timer() {
-    uint32_t cur = current_time();
-    for (;;) {
-        timer_entry_t *te = min_heap_top_(&min_heap);
-        if (!te) break;
-        if (te->time > cur) break;
-        te->handler(te);
-        min_heap_pop_(&min_heap);
-        free(te);
-    }
-}
-
-#endif // MARK_MINHEAP_TIMER_H
+#ifndef MARK_MINHEAP_TIMER_H
+#define MARK_MINHEAP_TIMER_H
+
+#if defined(__APPLE__)
+#include <AvailabilityMacros.h>
+#include <sys/time.h>
+#include <mach/task.h>
+#include <mach/mach.h>
+#else
+#include <time.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "minheap.h"
+#include "mempool.h"
+
+#define TIMER_FIXED_RATE  0 // 固定频率：下次超时时间 = 本次超时时间 + 间隔，不会累积漂移
+#define TIMER_FIXED_DELAY 1 // 固定延迟：下次超时时间 = 回调返回时的时间 + 间隔
+
+#ifdef TIMER_USE_POOL
+static mem_pool_t *entry_pool;  // 所有实例共享，线程本地缓存保证不同线程的实例互不争抢
+#endif
+
+// expire_timer 的就绪缓冲区：先把到期的定时器全部从堆中摘下，再依次执行回调
+#define TIMER_ENTRY_READY ((uint32_t)-2) // min_heap_idx 取该值表示在就绪缓冲区中等待执行
+
+typedef struct timer_stats_s {
+    unsigned size;              // 堆中元素个数（含墓碑）
+    unsigned tombstones;        // 当前墓碑个数
+    float tombstone_ratio;      // tombstones / size
+    uint64_t cancels;           // 累计 del_timer 次数
+    uint64_t compactions;       // 累计清理次数
+    uint64_t compaction_ns;     // 累计清理耗时
+    uint64_t max_compaction_ns; // 单次清理最大耗时
+} timer_stats_t;
+
+/*
+ * 定时器实例：每个事件循环各自创建一个，实例之间不共享任何状态
+ * 实例本身不加锁，只能在创建它的线程中使用
+ * 下面不带 mh_timer_ 前缀的 init_timer / add_timer / ... 操作进程内的默认实例
+ */
+#define TIMER_READY_MIN 64 // ready 缓冲区的初始容量，到期的定时器更多时按倍数扩容
+
+typedef struct mh_timer_s {
+    min_heap_t heap;
+    timer_entry_t **ready;
+    unsigned ready_cap;
+    bool expiring;
+    /*
+     * 延迟删除：del_timer 只把 handler 置空留下墓碑，堆顶遇到墓碑时才弹出释放；
+     * 墓碑占比超过 tombstone_limit 时一次性清理并 O(n) 重建堆
+     * 适用于绝大多数定时器在到期前就被取消的场景（如请求超时）
+     */
+    bool lazy_cancel;
+    float tombstone_limit;
+    timer_stats_t stats;
+} mh_timer_t;
+
+static uint32_t
+current_time() {
+	uint32_t t;
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	t = (uint32_t)ti.tv_sec * 1000;
+	t += ti.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	t = (uint32_t)tv.tv_sec * 1000;
+	t += tv.tv_usec / 1000;
+#endif
+	return t;
+}
+
+static uint64_t
+current_time_ns() {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000000 + ti.tv_nsec;
+}
+
+mh_timer_t * mh_timer_create() {
+    mh_timer_t *T = (mh_timer_t *)calloc(1, sizeof(mh_timer_t));
+    if (!T) {
+        return NULL;
+    }
+    min_heap_ctor_(&T->heap);
+    T->tombstone_limit = 0.5f;
+    T->ready = (timer_entry_t **)malloc(TIMER_READY_MIN * sizeof(timer_entry_t *));
+    if (!T->ready) {
+        free(T);
+        return NULL;
+    }
+    T->ready_cap = TIMER_READY_MIN;
+#ifdef TIMER_USE_POOL
+    if (!mem_pool_create_once(&entry_pool, sizeof(timer_entry_t), TIMER_POOL_SLAB, TIMER_POOL_FLAGS)) {
+        free(T->ready);
+        free(T);
+        return NULL;
+    }
+#endif
+    return T;
+}
+
+// 释放实例以及其中尚未到期的定时器
+void mh_timer_destroy(mh_timer_t *T) {
+    unsigned i;
+    for (i = 0; i < min_heap_size_(&T->heap); i++) {
+        timer_pool_free(entry_pool, T->heap.p[i].e);
+    }
+    min_heap_dtor_(&T->heap);
+    free(T->ready);
+    free(T);
+}
+
+#ifdef TIMER_USE_POOL
+void get_pool_stats(mem_pool_stats_t *st) {
+    mem_pool_stats(entry_pool, st);
+}
+#endif
+
+// 开启/关闭延迟删除，max_ratio 为触发清理的墓碑占比
+void mh_timer_set_lazy_cancel(mh_timer_t *T, bool enable, float max_ratio) {
+    T->lazy_cancel = enable;
+    T->tombstone_limit = max_ratio;
+}
+
+void mh_timer_stats(mh_timer_t *T, timer_stats_t *st) {
+    *st = T->stats;
+    st->size = min_heap_size_(&T->heap);
+    st->tombstone_ratio = st->size ? (float)st->tombstones / st->size : 0.0f;
+}
+
+static int free_tombstone(timer_entry_t *e, void *arg) {
+    (void)arg;
+    if (e->handler) return 0;
+    timer_pool_free(entry_pool, e);
+    return 1;
+}
+
+static void compact_timer(mh_timer_t *T) {
+    uint64_t begin = current_time_ns(), cost;
+    T->stats.tombstones -= min_heap_remove_if_(&T->heap, free_tombstone, NULL);
+    cost = current_time_ns() - begin;
+    T->stats.compactions++;
+    T->stats.compaction_ns += cost;
+    if (cost > T->stats.max_compaction_ns) T->stats.max_compaction_ns = cost;
+}
+
+static void pop_tombstones(mh_timer_t *T) { // 弹出并释放堆顶的墓碑
+    timer_entry_t *te;
+    while ((te = min_heap_top_(&T->heap)) && !te->handler) {
+        min_heap_pop_(&T->heap);
+        T->stats.tombstones--;
+        timer_pool_free(entry_pool, te);
+    }
+}
+
+timer_entry_t * mh_timer_add(mh_timer_t *T, uint32_t msec, timer_handler_pt callback) {
+    if (!callback) { // handler 为空表示已取消
+        return NULL;
+    }
+    timer_entry_t *te = timer_pool_alloc(entry_pool, timer_entry_t);
+    if (!te) {
+        return NULL;
+    }
+    memset(te, 0, sizeof(timer_entry_t));
+
+    te->handler = callback;
+    te->time = current_time() + msec;
+
+    if (0 != min_heap_push_(&T->heap, te)) {
+        timer_pool_free(entry_pool, te);
+        return NULL;
+    }
+    return te;
+}
+
+// 批量添加 n 个超时时间为 msec[i] 的定时器，结果写入 out[i]；数组只扩容一次，批量较大时 O(n) 建堆
+int mh_timer_add_many(mh_timer_t *T, unsigned n, const uint32_t *msec, timer_handler_pt callback, timer_entry_t **out) {
+    unsigned i;
+    uint32_t now = current_time();
+
+    if (!callback) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        timer_entry_t *te = timer_pool_alloc(entry_pool, timer_entry_t);
+        if (!te) {
+            goto failed;
+        }
+        memset(te, 0, sizeof(timer_entry_t));
+
+        te->handler = callback;
+        te->time = now + msec[i];
+        out[i] = te;
+    }
+
+    if (0 != min_heap_push_batch_(&T->heap, out, n)) {
+        goto failed;
+    }
+    return 0;
+
+failed:
+    while (i--) {
+        timer_pool_free(entry_pool, out[i]);
+        out[i] = NULL;
+    }
+    return -1;
+}
+
+// 周期定时器：每次回调之后原地修改 time 并通过 min_heap_adjust_ 重新入堆，直到 del_timer
+timer_entry_t * mh_timer_add_periodic(mh_timer_t *T, uint32_t interval, timer_handler_pt callback, int mode) {
+    if (!callback || !interval) {
+        return NULL;
+    }
+    timer_entry_t *te = timer_pool_alloc(entry_pool, timer_entry_t);
+    if (!te) {
+        return NULL;
+    }
+    memset(te, 0, sizeof(timer_entry_t));
+
+    te->handler = callback;
+    te->interval = interval;
+    te->mode = mode;
+    te->time = current_time() + interval;
+
+    if (0 != min_heap_push_(&T->heap, te)) {
+        timer_pool_free(entry_pool, te);
+        return NULL;
+    }
+    return te;
+}
+
+// 删除并释放一个定时器；若它已到期、正在就绪缓冲区中等待执行，则取消其回调，由 expire_timer 释放
+bool mh_timer_del(mh_timer_t *T, timer_entry_t *e) {
+    if (!e->handler) {
+        return false;
+    }
+    if (e->min_heap_idx == TIMER_ENTRY_READY) {
+        e->handler = NULL;
+        T->stats.cancels++;
+        return true;
+    }
+    if (T->lazy_cancel && e->min_heap_idx != (uint32_t)-1) {
+        e->handler = NULL;
+        T->stats.cancels++;
+        T->stats.tombstones++;
+        if (T->stats.tombstones > T->tombstone_limit * min_heap_size_(&T->heap)) {
+            compact_timer(T);
+        }
+        return true;
+    }
+    if (0 != min_heap_erase_(&T->heap, e)) {
+        return false;
+    }
+    T->stats.cancels++;
+    timer_pool_free(entry_pool, e);
+    return true;
+}
+
+int mh_timer_nearest(mh_timer_t *T) {
+    pop_tombstones(T);
+    timer_entry_t *te = min_heap_top_(&T->heap);
+    if (!te) return -1;
+    int diff = (int) te->time - (int)current_time();
+    return diff > 0 ? diff : 0;
+}
+
+/*
+ * 两阶段执行到期任务：
+ *   1. 一次性把 time <= now 的定时器从堆中摘到 ready 缓冲区
+ *   2. 再依次执行回调，此时堆已处于一致状态，回调中可以随意 add_timer / del_timer
+ * ready 缓冲区按到期的个数扩容：取满了就扩大一倍继续取，
+ *   扩容失败时先执行已取出的，其余的留到下一次 expire_timer
+ */
+void mh_timer_expire(mh_timer_t *T) {
+    unsigned i, n = 0;
+    uint32_t cur = current_time();
+    timer_entry_t **p;
+
+    if (T->expiring) return; // 回调中再调用 expire_timer 直接返回
+    while ((n += min_heap_pop_until_(&T->heap, cur, T->ready + n, T->ready_cap - n)) == T->ready_cap) {
+        p = (timer_entry_t **)realloc(T->ready, 2 * T->ready_cap * sizeof(*p));
+        if (!p) break;
+        T->ready = p;
+        T->ready_cap *= 2;
+    }
+    for (i = 0; i < n; i++) {
+        T->ready[i]->min_heap_idx = TIMER_ENTRY_READY;
+        if (!T->ready[i]->handler) {
+            T->stats.tombstones--; // 随到期一起摘下的墓碑
+        }
+    }
+
+    T->expiring = true;
+    for (i = 0; i < n; i++) {
+        timer_entry_t *te = T->ready[i];
+        if (te->handler) {
+            te->handler(te);
+        }
+        if (te->handler && te->interval) { // 回调中没有被取消的周期定时器重新入堆
+            te->time = te->mode == TIMER_FIXED_DELAY ? current_time() + te->interval : te->time + te->interval;
+            te->min_heap_idx = -1;
+            if (0 == min_heap_adjust_(&T->heap, te)) {
+                continue;
+            }
+        }
+        timer_pool_free(entry_pool, te);
+    }
+    T->expiring = false;
+}
+
+/* 默认实例，兼容原来的全局接口 */
+static mh_timer_t *default_timer;
+
+void init_timer() {
+    default_timer = mh_timer_create();
+}
+
+void set_lazy_cancel(bool enable, float max_ratio) {
+    mh_timer_set_lazy_cancel(default_timer, enable, max_ratio);
+}
+
+void get_timer_stats(timer_stats_t *st) {
+    mh_timer_stats(default_timer, st);
+}
+
+timer_entry_t * add_timer(uint32_t msec, timer_handler_pt callback) {
+    return mh_timer_add(default_timer, msec, callback);
+}
+
+int add_timers(unsigned n, const uint32_t *msec, timer_handler_pt callback, timer_entry_t **out) {
+    return mh_timer_add_many(default_timer, n, msec, callback, out);
+}
+
+timer_entry_t * add_periodic_timer(uint32_t interval, timer_handler_pt callback, int mode) {
+    return mh_timer_add_periodic(default_timer, interval, callback, mode);
+}
+
+bool del_timer(timer_entry_t *e) {
+    return mh_timer_del(default_timer, e);
+}
+
+int find_nearest_expire_timer() {
+    return mh_timer_nearest(default_timer);
+}
+
+void expire_timer() {
+    mh_timer_expire(default_timer);
+}
+
+#endif // MARK_MINHEAP_TIMER_H
@@ -1,408 +1,753 @@
-
-/*
- * Copyright (C) Igor Sysoev
- * Copyright (C) Nginx, Inc.
- */
-
-
-#include "rbtree.h"
-
-
-/*
- * The red-black tree code is based on the algorithm described in
- * the "Introduction to Algorithms" by Cormen, Leiserson and Rivest.
- */
-
-
-static inline void ngx_rbtree_left_rotate(ngx_rbtree_node_t **root,
-    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
-static inline void ngx_rbtree_right_rotate(ngx_rbtree_node_t **root,
-    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
-
-
-void
-ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
-{
-    ngx_rbtree_node_t  **root, *temp, *sentinel;
-
-    /* a binary tree insert */
-
-    root = &tree->root;
-    sentinel = tree->sentinel;
-
-    if (*root == sentinel) { // 是不是空的红黑树
-        node->parent = NULL;
-        node->left = sentinel;
-        node->right = sentinel;
-        ngx_rbt_black(node);
-        *root = node;
-
-        return;
-    }
-
-// 插入行为自定义
-    tree->insert(*root, node, sentinel);
-
-    /* re-balance tree */
-
-    while (node != *root && ngx_rbt_is_red(node->parent)) {
-
-        if (node->parent == node->parent->parent->left) {
-            temp = node->parent->parent->right;
-
-            if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
-                ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
-
-            } else {
-                if (node == node->parent->right) {
-                    node = node->parent;
-                    ngx_rbtree_left_rotate(root, sentinel, node);
-                }
-
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_rbtree_right_rotate(root, sentinel, node->parent->parent);
-            }
-
-        } else {
-            temp = node->parent->parent->left;
-
-            if (ngx_rbt_is_red(temp)) {
-                ngx_rbt_black(node->parent);
-                ngx_rbt_black(temp);
-                ngx_rbt_red(node->parent->parent);
-                node = node->parent->parent;
-
-            } else {
-                if (node == node->parent->left) {
-                    node = node->parent;
-                    ngx_rbtree_right_rotate(root, sentinel, node);
-                }
-
-                ngx_rbt_black(node->parent);
-                ngx_rbt_red(node->parent->parent);
-                ngx_rbtree_left_rotate(root, sentinel, node->parent->parent);
-            }
-        }
-    }
-
-    ngx_rbt_black(*root);
-}
-
-
-void
-ngx_rbtree_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
-    ngx_rbtree_node_t *sentinel)
-{
-    ngx_rbtree_node_t  **p;
-
-    for ( ;; ) {
-
-        p = (node->key < temp->key) ? &temp->left : &temp->right;
-
-        if (*p == sentinel) {
-            break;
-        }
-
-        temp = *p;
-    }
-
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
-}
-
-
-void
-ngx_rbtree_insert_timer_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
-    ngx_rbtree_node_t *sentinel)
-{
-    ngx_rbtree_node_t  **p;
-
-    for ( ;; ) {
-
-        /*
-         * Timer values
-         * 1) are spread in small range, usually several minutes,
-         * 2) and overflow each 49 days, if milliseconds are stored in 32 bits.
-         * The comparison takes into account that overflow.
-         */
-
-        /*  node->key < temp->key */
-        p = ((ngx_rbtree_key_int_t) (node->key - temp->key) < 0)
-            ? &temp->left : &temp->right;
-
-        if (*p == sentinel) {
-            break;
-        }
-
-        temp = *p;
-    }
-
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
-}
-
-
-void
-ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
-{
-    ngx_uint_t           red;
-    ngx_rbtree_node_t  **root, *sentinel, *subst, *temp, *w;
-
-    /* a binary tree delete */
-
-    root = &tree->root;
-    sentinel = tree->sentinel;
-
-    if (node->left == sentinel) {
-        temp = node->right;
-        subst = node;
-
-    } else if (node->right == sentinel) {
-        temp = node->left;
-        subst = node;
-
-    } else {
-        subst = ngx_rbtree_min(node->right, sentinel);
-
-        if (subst->left != sentinel) {
-            temp = subst->left;
-        } else {
-            temp = subst->right;
-        }
-    }
-
-    if (subst == *root) {
-        *root = temp;
-        ngx_rbt_black(temp);
-
-        /* DEBUG stuff */
-        node->left = NULL;
-        node->right = NULL;
-        node->parent = NULL;
-        node->key = 0;
-
-        return;
-    }
-
-    red = ngx_rbt_is_red(subst);
-
-    if (subst == subst->parent->left) {
-        subst->parent->left = temp;
-
-    } else {
-        subst->parent->right = temp;
-    }
-
-    if (subst == node) {
-
-        temp->parent = subst->parent;
-
-    } else {
-
-        if (subst->parent == node) {
-            temp->parent = subst;
-
-        } else {
-            temp->parent = subst->parent;
-        }
-
-        subst->left = node->left;
-        subst->right = node->right;
-        subst->parent = node->parent;
-        ngx_rbt_copy_color(subst, node);
-
-        if (node == *root) {
-            *root = subst;
-
-        } else {
-            if (node == node->parent->left) {
-                node->parent->left = subst;
-            } else {
-                node->parent->right = subst;
-            }
-        }
-
-        if (subst->left != sentinel) {
-            subst->left->parent = subst;
-        }
-
-        if (subst->right != sentinel) {
-            subst->right->parent = subst;
-        }
-    }
-
-    /* DEBUG stuff */
-    node->left = NULL;
-    node->right = NULL;
-    node->parent = NULL;
-    node->key = 0;
-
-    if (red) {
-        return;
-    }
-
-    /* a delete fixup */
-
-    while (temp != *root && ngx_rbt_is_black(temp)) {
-
-        if (temp == temp->parent->left) {
-            w = temp->parent->right;
-
-            if (ngx_rbt_is_red(w)) {
-                ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
-                w = temp->parent->right;
-            }
-
-            if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
-                ngx_rbt_red(w);
-                temp = temp->parent;
-
-            } else {
-                if (ngx_rbt_is_black(w->right)) {
-                    ngx_rbt_black(w->left);
-                    ngx_rbt_red(w);
-                    ngx_rbtree_right_rotate(root, sentinel, w);
-                    w = temp->parent->right;
-                }
-
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
-                ngx_rbt_black(w->right);
-                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
-                temp = *root;
-            }
-
-        } else {
-            w = temp->parent->left;
-
-            if (ngx_rbt_is_red(w)) {
-                ngx_rbt_black(w);
-                ngx_rbt_red(temp->parent);
-                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
-                w = temp->parent->left;
-            }
-
-            if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
-                ngx_rbt_red(w);
-                temp = temp->parent;
-
-            } else {
-                if (ngx_rbt_is_black(w->left)) {
-                    ngx_rbt_black(w->right);
-                    ngx_rbt_red(w);
-                    ngx_rbtree_left_rotate(root, sentinel, w);
-                    w = temp->parent->left;
-                }
-
-                ngx_rbt_copy_color(w, temp->parent);
-                ngx_rbt_black(temp->parent);
-                ngx_rbt_black(w->left);
-                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
-                temp = *root;
-            }
-        }
-    }
-
-    ngx_rbt_black(temp);
-}
-
-
-static inline void
-ngx_rbtree_left_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
-    ngx_rbtree_node_t *node)
-{
-    ngx_rbtree_node_t  *temp;
-
-    temp = node->right;
-    node->right = temp->left;
-
-    if (temp->left != sentinel) {
-        temp->left->parent = node;
-    }
-
-    temp->parent = node->parent;
-
-    if (node == *root) {
-        *root = temp;
-
-    } else if (node == node->parent->left) {
-        node->parent->left = temp;
-
-    } else {
-        node->parent->right = temp;
-    }
-
-    temp->left = node;
-    node->parent = temp;
-}
-
-
-static inline void
-ngx_rbtree_right_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
-    ngx_rbtree_node_t *node)
-{
-    ngx_rbtree_node_t  *temp;
-
-    temp = node->left;
-    node->left = temp->right;
-
-    if (temp->right != sentinel) {
-        temp->right->parent = node;
-    }
-
-    temp->parent = node->parent;
-
-    if (node == *root) {
-        *root = temp;
-
-    } else if (node == node->parent->right) {
-        node->parent->right = temp;
-
-    } else {
-        node->parent->left = temp;
-    }
-
-    temp->right = node;
-    node->parent = temp;
-}
-
-
-ngx_rbtree_node_t *
-ngx_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
-{
-    ngx_rbtree_node_t  *root, *sentinel, *parent;
-
-    sentinel = tree->sentinel;
-
-    if (node->right != sentinel) {
-        return ngx_rbtree_min(node->right, sentinel);
-    }
-
-    root = tree->root;
-
-    for ( ;; ) {
-        parent = node->parent;
-
-        if (node == root) {
-            return NULL;
-        }
-
-        if (node == parent->left) {
-            return parent;
-        }
-
-        node = parent;
-    }
-}
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include "rbtree.h"
+
+
+/*
+ * The red-black tree code is based on the algorithm described in
+ * the "Introduction to Algorithms" by Cormen, Leiserson and Rivest.
+ */
+
+
+static inline void ngx_rbtree_left_rotate(ngx_rbtree_node_t **root,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+static inline void ngx_rbtree_right_rotate(ngx_rbtree_node_t **root,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+static inline ngx_uint_t ngx_rbtree_is_append(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node);
+static void ngx_rbtree_insert_fixup(ngx_rbtree_node_t **root,
+    ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+static ngx_rbtree_node_t *ngx_rbtree_split_le(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node, ngx_rbtree_key_t key, ngx_rbtree_node_t ***tail);
+static ngx_rbtree_node_t *ngx_rbtree_join(ngx_rbtree_node_t *left,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *right,
+    ngx_rbtree_node_t *sentinel);
+
+
+void
+ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  **root, *temp, *sentinel;
+
+    /* a binary tree insert */
+
+    root = &tree->root;
+    sentinel = tree->sentinel;
+
+    if (*root == sentinel) { // 是不是空的红黑树
+        node->parent = NULL;
+        node->left = sentinel;
+        node->right = sentinel;
+        ngx_rbt_black(node);
+        *root = node;
+        tree->leftmost = node;
+        tree->rightmost = node;
+
+        return;
+    }
+
+    if (ngx_rbtree_is_append(tree, node)) {
+
+        /* the key is not less than the maximum: skip the descent */
+
+        temp = tree->rightmost;
+        temp->right = node;
+        node->parent = temp;
+        node->left = sentinel;
+        node->right = sentinel;
+        ngx_rbt_red(node);
+        tree->rightmost = node;
+
+    } else {
+
+// 插入行为自定义
+        tree->insert(*root, node, sentinel);
+
+        /* the new minimum can only be the left child of the old one */
+
+        if (node->parent == tree->leftmost && node == tree->leftmost->left) {
+            tree->leftmost = node;
+        }
+
+        if (node->parent == tree->rightmost
+            && node == tree->rightmost->right)
+        {
+            tree->rightmost = node;
+        }
+    }
+
+    /* re-balance tree */
+
+    ngx_rbtree_insert_fixup(root, sentinel, node);
+}
+
+
+static void
+ngx_rbtree_insert_fixup(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *temp;
+
+    while (node != *root && ngx_rbt_is_red(node->parent)) {
+
+        if (node->parent == node->parent->parent->left) {
+            temp = node->parent->parent->right;
+
+            if (ngx_rbt_is_red(temp)) {
+                ngx_rbt_black(node->parent);
+                ngx_rbt_black(temp);
+                ngx_rbt_red(node->parent->parent);
+                node = node->parent->parent;
+
+            } else {
+                if (node == node->parent->right) {
+                    node = node->parent;
+                    ngx_rbtree_left_rotate(root, sentinel, node);
+                }
+
+                ngx_rbt_black(node->parent);
+                ngx_rbt_red(node->parent->parent);
+                ngx_rbtree_right_rotate(root, sentinel, node->parent->parent);
+            }
+
+        } else {
+            temp = node->parent->parent->left;
+
+            if (ngx_rbt_is_red(temp)) {
+                ngx_rbt_black(node->parent);
+                ngx_rbt_black(temp);
+                ngx_rbt_red(node->parent->parent);
+                node = node->parent->parent;
+
+            } else {
+                if (node == node->parent->left) {
+                    node = node->parent;
+                    ngx_rbtree_right_rotate(root, sentinel, node);
+                }
+
+                ngx_rbt_black(node->parent);
+                ngx_rbt_red(node->parent->parent);
+                ngx_rbtree_left_rotate(root, sentinel, node->parent->parent);
+            }
+        }
+    }
+
+    ngx_rbt_black(*root);
+}
+
+
+void
+ngx_rbtree_insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t  **p;
+
+    for ( ;; ) {
+
+        p = (node->key < temp->key) ? &temp->left : &temp->right;
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+void
+ngx_rbtree_insert_timer_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t  **p;
+
+    for ( ;; ) {
+
+        /*
+         * Timer values
+         * 1) are spread in small range, usually several minutes,
+         * 2) and overflow each 49 days, if milliseconds are stored in 32 bits.
+         * The comparison takes into account that overflow.
+         */
+
+        /*  node->key < temp->key */
+        p = ((ngx_rbtree_key_int_t) (node->key - temp->key) < 0)
+            ? &temp->left : &temp->right;
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+/*
+ * Fixed-timeout timers are almost always inserted with the largest key,
+ * so a node that would end up as the right child of the maximum is
+ * linked there directly.  Only the two built-in insert functions are
+ * known to place equal keys to the right; custom ones always descend.
+ */
+
+static inline ngx_uint_t
+ngx_rbtree_is_append(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *max;
+
+    max = tree->rightmost;
+
+    if (tree->insert == ngx_rbtree_insert_value) {
+        return node->key >= max->key;
+    }
+
+    if (tree->insert == ngx_rbtree_insert_timer_value) {
+        return (ngx_rbtree_key_int_t) (node->key - max->key) >= 0;
+    }
+
+    return 0;
+}
+
+
+void
+ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_uint_t           red;
+    ngx_rbtree_node_t  **root, *sentinel, *subst, *temp, *w;
+
+    /* a binary tree delete */
+
+    root = &tree->root;
+    sentinel = tree->sentinel;
+
+    if (node == tree->leftmost) {
+        tree->leftmost = ngx_rbtree_next(tree, node);
+    }
+
+    if (node == tree->rightmost) {
+        tree->rightmost = ngx_rbtree_prev(tree, node);
+    }
+
+    if (node->left == sentinel) {
+        temp = node->right;
+        subst = node;
+
+    } else if (node->right == sentinel) {
+        temp = node->left;
+        subst = node;
+
+    } else {
+        subst = ngx_rbtree_min(node->right, sentinel);
+
+        if (subst->left != sentinel) {
+            temp = subst->left;
+        } else {
+            temp = subst->right;
+        }
+    }
+
+    if (subst == *root) {
+        *root = temp;
+        ngx_rbt_black(temp);
+
+        /* DEBUG stuff */
+        node->left = NULL;
+        node->right = NULL;
+        node->parent = NULL;
+        node->key = 0;
+
+        return;
+    }
+
+    red = ngx_rbt_is_red(subst);
+
+    if (subst == subst->parent->left) {
+        subst->parent->left = temp;
+
+    } else {
+        subst->parent->right = temp;
+    }
+
+    if (subst == node) {
+
+        temp->parent = subst->parent;
+
+    } else {
+
+        if (subst->parent == node) {
+            temp->parent = subst;
+
+        } else {
+            temp->parent = subst->parent;
+        }
+
+        subst->left = node->left;
+        subst->right = node->right;
+        subst->parent = node->parent;
+        ngx_rbt_copy_color(subst, node);
+
+        if (node == *root) {
+            *root = subst;
+
+        } else {
+            if (node == node->parent->left) {
+                node->parent->left = subst;
+            } else {
+                node->parent->right = subst;
+            }
+        }
+
+        if (subst->left != sentinel) {
+            subst->left->parent = subst;
+        }
+
+        if (subst->right != sentinel) {
+            subst->right->parent = subst;
+        }
+    }
+
+    /* DEBUG stuff */
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+    node->key = 0;
+
+    if (red) {
+        return;
+    }
+
+    /* a delete fixup */
+
+    while (temp != *root && ngx_rbt_is_black(temp)) {
+
+        if (temp == temp->parent->left) {
+            w = temp->parent->right;
+
+            if (ngx_rbt_is_red(w)) {
+                ngx_rbt_black(w);
+                ngx_rbt_red(temp->parent);
+                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
+                w = temp->parent->right;
+            }
+
+            if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
+                ngx_rbt_red(w);
+                temp = temp->parent;
+
+            } else {
+                if (ngx_rbt_is_black(w->right)) {
+                    ngx_rbt_black(w->left);
+                    ngx_rbt_red(w);
+                    ngx_rbtree_right_rotate(root, sentinel, w);
+                    w = temp->parent->right;
+                }
+
+                ngx_rbt_copy_color(w, temp->parent);
+                ngx_rbt_black(temp->parent);
+                ngx_rbt_black(w->right);
+                ngx_rbtree_left_rotate(root, sentinel, temp->parent);
+                temp = *root;
+            }
+
+        } else {
+            w = temp->parent->left;
+
+            if (ngx_rbt_is_red(w)) {
+                ngx_rbt_black(w);
+                ngx_rbt_red(temp->parent);
+                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
+                w = temp->parent->left;
+            }
+
+            if (ngx_rbt_is_black(w->left) && ngx_rbt_is_black(w->right)) {
+                ngx_rbt_red(w);
+                temp = temp->parent;
+
+            } else {
+                if (ngx_rbt_is_black(w->left)) {
+                    ngx_rbt_black(w->right);
+                    ngx_rbt_red(w);
+                    ngx_rbtree_left_rotate(root, sentinel, w);
+                    w = temp->parent->left;
+                }
+
+                ngx_rbt_copy_color(w, temp->parent);
+                ngx_rbt_black(temp->parent);
+                ngx_rbt_black(w->left);
+                ngx_rbtree_right_rotate(root, sentinel, temp->parent);
+                temp = *root;
+            }
+        }
+    }
+
+    ngx_rbt_black(temp);
+}
+
+
+static inline void
+ngx_rbtree_left_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *temp;
+
+    temp = node->right;
+    node->right = temp->left;
+
+    if (temp->left != sentinel) {
+        temp->left->parent = node;
+    }
+
+    temp->parent = node->parent;
+
+    if (node == *root) {
+        *root = temp;
+
+    } else if (node == node->parent->left) {
+        node->parent->left = temp;
+
+    } else {
+        node->parent->right = temp;
+    }
+
+    temp->left = node;
+    node->parent = temp;
+}
+
+
+static inline void
+ngx_rbtree_right_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *temp;
+
+    temp = node->left;
+    node->left = temp->right;
+
+    if (temp->right != sentinel) {
+        temp->right->parent = node;
+    }
+
+    temp->parent = node->parent;
+
+    if (node == *root) {
+        *root = temp;
+
+    } else if (node == node->parent->right) {
+        node->parent->right = temp;
+
+    } else {
+        node->parent->left = temp;
+    }
+
+    temp->right = node;
+    node->parent = temp;
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *root, *sentinel, *parent;
+
+    sentinel = tree->sentinel;
+
+    if (node->right != sentinel) {
+        return ngx_rbtree_min(node->right, sentinel);
+    }
+
+    root = tree->root;
+
+    for ( ;; ) {
+        parent = node->parent;
+
+        if (node == root) {
+            return NULL;
+        }
+
+        if (node == parent->left) {
+            return parent;
+        }
+
+        node = parent;
+    }
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_prev(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *root, *sentinel, *parent;
+
+    sentinel = tree->sentinel;
+
+    if (node->left != sentinel) {
+        node = node->left;
+
+        while (node->right != sentinel) {
+            node = node->right;
+        }
+
+        return node;
+    }
+
+    root = tree->root;
+
+    for ( ;; ) {
+        parent = node->parent;
+
+        if (node == root) {
+            return NULL;
+        }
+
+        if (node == parent->right) {
+            return parent;
+        }
+
+        node = parent;
+    }
+}
+
+
+/*
+ * Range detach for timers: after a stall thousands of nodes may expire at
+ * once, and deleting them one by one runs a delete fixup for each.
+ * Instead the tree is split at the key with join-based split: every node
+ * on the search path whose key is greater is joined back together with
+ * the remaining part of its left subtree, every other node and its left
+ * subtree is moved to the result list.  That is O(k + log^2 n) for k
+ * detached nodes and leaves a valid red-black tree.
+ */
+
+static inline ngx_uint_t
+ngx_rbtree_key_le(ngx_rbtree_t *tree, ngx_rbtree_key_t a, ngx_rbtree_key_t b)
+{
+    if (tree->insert == ngx_rbtree_insert_timer_value) {
+        return (ngx_rbtree_key_int_t) (a - b) <= 0;
+    }
+
+    return a <= b;
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_detach_le(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t  *head, **tail, *root, *sentinel;
+
+    /*
+     * nothing expired: skip the split, it would only rebuild the search
+     * path; the result below does not depend on this check
+     */
+
+    if (tree->leftmost == NULL
+        || !ngx_rbtree_key_le(tree, tree->leftmost->key, key))
+    {
+        return NULL;
+    }
+
+    sentinel = tree->sentinel;
+    head = NULL;
+    tail = &head;
+
+    root = ngx_rbtree_split_le(tree, tree->root, key, &tail);
+    *tail = NULL;
+
+    /*
+     * the split joins the search path back together even if nothing was
+     * detached, so the new root must always be stored
+     */
+
+    tree->root = root;
+
+    if (root == sentinel) {
+        tree->leftmost = NULL;
+        tree->rightmost = NULL;
+
+    } else {
+        root->parent = NULL;
+        ngx_rbt_black(root);
+        tree->leftmost = ngx_rbtree_min(root, sentinel);
+    }
+
+    return head;
+}
+
+
+static void
+ngx_rbtree_collect(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel,
+    ngx_rbtree_node_t ***tail)
+{
+    ngx_rbtree_node_t  *right;
+
+    while (node != sentinel) {
+        ngx_rbtree_collect(node->left, sentinel, tail);
+
+        right = node->right;
+
+        node->left = NULL;
+        node->parent = NULL;
+        **tail = node;
+        *tail = &node->right;
+
+        node = right;
+    }
+}
+
+
+static ngx_rbtree_node_t *
+ngx_rbtree_split_le(ngx_rbtree_t *tree, ngx_rbtree_node_t *node,
+    ngx_rbtree_key_t key, ngx_rbtree_node_t ***tail)
+{
+    ngx_rbtree_node_t  *left, *right, *sentinel;
+
+    sentinel = tree->sentinel;
+
+    while (node != sentinel && ngx_rbtree_key_le(tree, node->key, key)) {
+
+        /* the node and its whole left subtree are detached */
+
+        ngx_rbtree_collect(node->left, sentinel, tail);
+
+        right = node->right;
+
+        node->left = NULL;
+        node->parent = NULL;
+        **tail = node;
+        *tail = &node->right;
+
+        node = right;
+    }
+
+    if (node == sentinel) {
+        return sentinel;
+    }
+
+    right = node->right;
+    left = ngx_rbtree_split_le(tree, node->left, key, tail);
+
+    return ngx_rbtree_join(left, node, right, sentinel);
+}
+
+
+static ngx_uint_t
+ngx_rbtree_black_height(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_uint_t  h;
+
+    for (h = 0; node != sentinel; node = node->left) {
+        h += ngx_rbt_is_black(node);
+    }
+
+    return h;
+}
+
+
+/*
+ * joins two valid trees with a node whose key lies between them:
+ * the node is hung as a red node next to the black node of equal black
+ * height on the spine of the higher tree and the red-red violation is
+ * repaired with the insert fixup
+ */
+
+static ngx_rbtree_node_t *
+ngx_rbtree_join(ngx_rbtree_node_t *left, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *right, ngx_rbtree_node_t *sentinel)
+{
+    ngx_uint_t          hl, hr, h;
+    ngx_rbtree_node_t  *root, *temp, *parent;
+
+    if (left != sentinel) {
+        left->parent = NULL;
+        ngx_rbt_black(left);
+    }
+
+    if (right != sentinel) {
+        right->parent = NULL;
+        ngx_rbt_black(right);
+    }
+
+    hl = ngx_rbtree_black_height(left, sentinel);
+    hr = ngx_rbtree_black_height(right, sentinel);
+
+    if (hl == hr) {
+        node->left = left;
+        node->right = right;
+        node->parent = NULL;
+        ngx_rbt_black(node);
+
+        if (left != sentinel) {
+            left->parent = node;
+        }
+
+        if (right != sentinel) {
+            right->parent = node;
+        }
+
+        return node;
+    }
+
+    parent = NULL;
+
+    if (hl > hr) {
+        root = left;
+        temp = left;
+        h = hl;
+
+        while (!(ngx_rbt_is_black(temp) && h == hr)) {
+            h -= ngx_rbt_is_black(temp);
+            parent = temp;
+            temp = temp->right;
+        }
+
+        parent->right = node;
+        node->left = temp;
+        node->right = right;
+
+    } else {
+        root = right;
+        temp = right;
+        h = hr;
+
+        while (!(ngx_rbt_is_black(temp) && h == hl)) {
+            h -= ngx_rbt_is_black(temp);
+            parent = temp;
+            temp = temp->left;
+        }
+
+        parent->left = node;
+        node->left = left;
+        node->right = temp;
+    }
+
+    node->parent = parent;
+    ngx_rbt_red(node);
+
+    if (node->left != sentinel) {
+        node->left->parent = node;
+    }
+
+    if (node->right != sentinel) {
+        node->right->parent = node;
+    }
+
+    ngx_rbtree_insert_fixup(&root, sentinel, node);
+
+    return root;
+}
\ No newline at end of file
@@ -1,84 +1,103 @@
-
-/*
- * Copyright (C) Igor Sysoev
- * Copyright (C) Nginx, Inc.
- */
-
-#ifndef _NGX_RBTREE_H_INCLUDED_
-#define _NGX_RBTREE_H_INCLUDED_
-
-typedef unsigned int  ngx_rbtree_key_t;
-typedef unsigned int  ngx_uint_t;
-typedef int   ngx_rbtree_key_int_t;
-typedef unsigned char u_char;
-#ifndef NULL
-    #define NULL ((void*)0)
-#endif
-
-typedef struct ngx_rbtree_node_s  ngx_rbtree_node_t;
-
-struct ngx_rbtree_node_s {
-    ngx_rbtree_key_t       key;
-    ngx_rbtree_node_t     *left;
-    ngx_rbtree_node_t     *right;
-    ngx_rbtree_node_t     *parent;
-    u_char                 color;
-    u_char                 data;
-};
-
-typedef struct ngx_rbtree_s  ngx_rbtree_t;
-
-typedef void (*ngx_rbtree_insert_pt) (ngx_rbtree_node_t *root,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
-
-struct ngx_rbtree_s {
-    ngx_rbtree_node_t     *root;
-    ngx_rbtree_node_t     *sentinel;
-    ngx_rbtree_insert_pt   insert;
-};
-
-#define ngx_rbtree_init(tree, s, i)                                           \
-    ngx_rbtree_sentinel_init(s);                                              \
-    (tree)->root = s;                                                         \
-    (tree)->sentinel = s;                                                     \
-    (tree)->insert = i
-
-void 
-ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
-
-void
-ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
-
-void
-ngx_rbtree_insert_value(ngx_rbtree_node_t *root, ngx_rbtree_node_t *node,
-    ngx_rbtree_node_t *sentinel);
-    
-void
-ngx_rbtree_insert_timer_value(ngx_rbtree_node_t *root,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
-
-ngx_rbtree_node_t *
-ngx_rbtree_next(ngx_rbtree_t *tree,
-    ngx_rbtree_node_t *node);
-
-#define ngx_rbt_red(node)               ((node)->color = 1)
-#define ngx_rbt_black(node)             ((node)->color = 0)
-#define ngx_rbt_is_red(node)            ((node)->color)
-#define ngx_rbt_is_black(node)          (!ngx_rbt_is_red(node))
-#define ngx_rbt_copy_color(n1, n2)      (n1->color = n2->color)
-
-/* a sentinel must be black */
-
-#define ngx_rbtree_sentinel_init(node)  ngx_rbt_black(node)
-
-static ngx_rbtree_node_t *
-ngx_rbtree_min(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
-{
-    while (node->left != sentinel) {
-        node = node->left;
-    }
-
-    return node;
-}
-
-#endif /* _NGX_RBTREE_H_INCLUDED_ */
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+#ifndef _NGX_RBTREE_H_INCLUDED_
+#define _NGX_RBTREE_H_INCLUDED_
+
+typedef unsigned int  ngx_rbtree_key_t;
+typedef unsigned int  ngx_uint_t;
+typedef int   ngx_rbtree_key_int_t;
+typedef unsigned char u_char;
+#ifndef NULL
+    #define NULL ((void*)0)
+#endif
+
+typedef struct ngx_rbtree_node_s  ngx_rbtree_node_t;
+
+struct ngx_rbtree_node_s {
+    ngx_rbtree_key_t       key;
+    ngx_rbtree_node_t     *left;
+    ngx_rbtree_node_t     *right;
+    ngx_rbtree_node_t     *parent;
+    u_char                 color;
+    u_char                 data;
+};
+
+typedef struct ngx_rbtree_s  ngx_rbtree_t;
+
+typedef void (*ngx_rbtree_insert_pt) (ngx_rbtree_node_t *root,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+struct ngx_rbtree_s {
+    ngx_rbtree_node_t     *root;
+    ngx_rbtree_node_t     *sentinel;
+    ngx_rbtree_insert_pt   insert;
+    ngx_rbtree_node_t     *leftmost;   /* cached minimum, NULL if empty */
+    ngx_rbtree_node_t     *rightmost;  /* cached maximum, NULL if empty */
+};
+
+#define ngx_rbtree_init(tree, s, i)                                           \
+    ngx_rbtree_sentinel_init(s);                                              \
+    (tree)->root = s;                                                         \
+    (tree)->sentinel = s;                                                     \
+    (tree)->insert = i;                                                       \
+    (tree)->leftmost = NULL;                                                  \
+    (tree)->rightmost = NULL
+
+/* O(1): the minimum is maintained by ngx_rbtree_insert/ngx_rbtree_delete */
+#define ngx_rbtree_leftmost(tree)       ((tree)->leftmost)
+#define ngx_rbtree_rightmost(tree)      ((tree)->rightmost)
+
+void 
+ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+
+void
+ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+
+void
+ngx_rbtree_insert_value(ngx_rbtree_node_t *root, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+    
+void
+ngx_rbtree_insert_timer_value(ngx_rbtree_node_t *root,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+ngx_rbtree_node_t *
+ngx_rbtree_next(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node);
+
+ngx_rbtree_node_t *
+ngx_rbtree_prev(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node);
+
+/*
+ * removes all nodes with key <= the given key in one operation and
+ * returns them in key order, linked through ->right and NULL-terminated
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_detach_le(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
+
+#define ngx_rbt_red(node)               ((node)->color = 1)
+#define ngx_rbt_black(node)             ((node)->color = 0)
+#define ngx_rbt_is_red(node)            ((node)->color)
+#define ngx_rbt_is_black(node)          (!ngx_rbt_is_red(node))
+#define ngx_rbt_copy_color(n1, n2)      (n1->color = n2->color)
+
+/* a sentinel must be black */
+
+#define ngx_rbtree_sentinel_init(node)  ngx_rbt_black(node)
+
+static inline ngx_rbtree_node_t *
+ngx_rbtree_min(ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    while (node->left != sentinel) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+#endif /* _NGX_RBTREE_H_INCLUDED_ */
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rbtree.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t rnd_state = 2463534242u;
+static uint32_t rnd() {  // xorshift32
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+// 与 ngx_rbtree_insert_value 行为相同，但不是内置插入函数，因此不会走追加快速路径
+static void insert_value_no_append(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel) {
+    ngx_rbtree_insert_value(temp, node, sentinel);
+}
+
+/*
+ * 插入 n 个定时器后全部按到期顺序删除
+ *   fixed：固定超时时间（当前时间 + 30s），每毫秒约 100 个定时器，key 单调不减
+ *   mixed：90% 固定超时，10% 为更短的随机超时
+ */
+static void bench(const char *name, unsigned n, int random_pct, ngx_rbtree_insert_pt insert) {
+    ngx_rbtree_t tree;
+    ngx_rbtree_node_t sentinel, *node;
+    ngx_rbtree_node_t *nodes = (ngx_rbtree_node_t *)calloc(n, sizeof(*nodes));
+    unsigned i;
+    uint64_t t0, t1, t2;
+
+    ngx_rbtree_init(&tree, &sentinel, insert);
+    for (i = 0; i < n; i++) {
+        uint32_t now = i / 100;
+        nodes[i].key = (int)(rnd() % 100) < random_pct ? now + rnd() % 30000 : now + 30000;
+    }
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        ngx_rbtree_insert(&tree, &nodes[i]);
+    t1 = now_ns();
+    while ((node = ngx_rbtree_leftmost(&tree)) != NULL)
+        ngx_rbtree_delete(&tree, node);
+    t2 = now_ns();
+
+    printf("%-8s %-10s n=%u insert=%.1fns delete-min=%.1fns\n", name,
+        insert == ngx_rbtree_insert_value ? "append" : "descend", n,
+        (double)(t1 - t0) / n, (double)(t2 - t1) / n);
+    free(nodes);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 1000000;
+
+    bench("fixed", n, 0, insert_value_no_append);
+    bench("fixed", n, 0, ngx_rbtree_insert_value);
+    bench("mixed", n, 10, insert_value_no_append);
+    bench("mixed", n, 10, ngx_rbtree_insert_value);
+    bench("random", n, 100, insert_value_no_append);
+    bench("random", n, 100, ngx_rbtree_insert_value);
+    return 0;
+}
+
+// gcc -O2 rbtree_bench.c rbtree.c -o rbt_bench
@@ -1,107 +1,201 @@
-#ifndef _MARK_RBT_
-#define _MARK_RBT_
-
-#include <stdio.h>
-#include <stdint.h>
-#include <string.h>
-#include <unistd.h>
-#include <stdlib.h>
-#include <stddef.h>
-
-#if defined(__APPLE__)
-#include <AvailabilityMacros.h>
-#include <sys/time.h>
-#include <mach/task.h>
-#include <mach/mach.h>
-#else
-#include <time.h>
-#endif
-
-#include "rbtree.h"
-#include <linux/time.h>
-
-ngx_rbtree_t              timer;
-static ngx_rbtree_node_t  sentinel;
-
-typedef struct timer_entry_s timer_entry_t;
-typedef void (*timer_handler_pt)(timer_entry_t *ev);
-
-struct timer_entry_s {
-    ngx_rbtree_node_t rbnode;
-    timer_handler_pt handler;
-};
-
-
-static uint32_t current_time() {
-    uint32_t t;
-#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
-	struct timespec ti;
-    clock_gettime(CLOCK_MONOTONIC, &ti);
-    t = (uint32_t)ti.tv_sec * 1000;
-    t += ti.tv_nsec / 1000000;
-#else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    t = (uint32_t)tv.tv_sec * 1000;
-    t += tv.tv_usec / 1000;
-#endif
-    return t;
-}
-
-
-ngx_rbtree_t* init_timer() {
-    ngx_rbtree_init(&timer, &sentinel, ngx_rbtree_insert_value);
-    return &timer;
-}
-
-timer_entry_t* add_timer(uint32_t msec, timer_handler_pt func) {  // 向红黑树添加一个定时任务，指定 超时时间 和任务的 回调函数 
-    timer_entry_t *te = (timer_entry_t *)malloc(sizeof(*te));
-    memset(te, 0, sizeof(*te));
-    
-    te->handler = func;
-    msec += current_time();
-    printf("add_timer expire at msec = %u\n", msec);
-    te->rbnode.key = msec;
-    ngx_rbtree_insert(&timer, &te->rbnode);
-
-    return te;
-}
-
-
-void del_timer(timer_entry_t *te) {
-    ngx_rbtree_delete(&timer, &te->rbnode);
-    free(te);
-}
-
-
-int find_nearst_expire_timer() {
-    ngx_rbtree_node_t *node;
-    if (timer.root == &sentinel) {
-        return -1;
-    }
-    node = ngx_rbtree_min(timer.root, timer.sentinel);
-    int diff = (int)node->key - (int)current_time();
-
-    return diff > 0 ? diff : 0;
-}
-
-
-void expire_timer() {
-    timer_entry_t *te;
-    ngx_rbtree_node_t *sentinel, *root, *node;
-    sentinel = timer.sentinel;
-    uint32_t now = current_time();
-    while (1) {
-        root = timer.root;
-        if (root == sentinel) break;
-        node = ngx_rbtree_min(root, sentinel);
-        if (node->key > now) break;
-        printf("touch timer expire time=%u, now = %u\n", node->key, now);
-        te = (timer_entry_t *) ((char *)node - offsetof(timer_entry_t, rbnode));
-        te->handler(te);
-        ngx_rbtree_delete(&timer, &te->rbnode);
-        free(te);
-    }
-}
-
+#ifndef _MARK_RBT_
+#define _MARK_RBT_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#if defined(__APPLE__)
+#include <AvailabilityMacros.h>
+#include <sys/time.h>
+#include <mach/task.h>
+#include <mach/mach.h>
+#else
+#include <time.h>
+#endif
+
+#include "rbtree.h"
+#include "mempool.h"
+
+#ifdef TIMER_USE_POOL
+static mem_pool_t        *entry_pool;  // 所有实例共享
+#endif
+
+#define TIMER_FIXED_RATE  0 // 固定频率：下次超时时间 = 本次超时时间 + 间隔，不会累积漂移
+#define TIMER_FIXED_DELAY 1 // 固定延迟：下次超时时间 = 回调返回时的时间 + 间隔
+
+typedef struct timer_entry_s timer_entry_t;
+typedef void (*timer_handler_pt)(timer_entry_t *ev);
+
+struct timer_entry_s {
+    ngx_rbtree_node_t rbnode;
+    timer_handler_pt handler;
+    uint32_t interval; // 周期定时器的间隔，0 表示一次性定时器
+    uint8_t mode;      // 周期定时器的重新调度方式
+    uint8_t firing;    // 正在执行回调，此时节点已不在红黑树中
+    uint8_t cancel;    // 回调执行期间被 del_timer 取消
+};
+
+/*
+ * 定时器实例：每个事件循环各自创建一个，实例本身不加锁，只能在创建它的线程中使用
+ * 下面不带 rb_timer_ 前缀的 init_timer / add_timer / ... 操作进程内的默认实例
+ */
+typedef struct rb_timer_s {
+    ngx_rbtree_t tree;
+    ngx_rbtree_node_t sentinel;
+} rb_timer_t;
+
+
+static uint32_t current_time() {
+    uint32_t t;
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+	struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    t = (uint32_t)ti.tv_sec * 1000;
+    t += ti.tv_nsec / 1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    t = (uint32_t)tv.tv_sec * 1000;
+    t += tv.tv_usec / 1000;
+#endif
+    return t;
+}
+
+
+rb_timer_t* rb_timer_create() {
+    rb_timer_t *T = (rb_timer_t *)malloc(sizeof(rb_timer_t));
+    if (T == NULL)
+        return NULL;
+    ngx_rbtree_init(&T->tree, &T->sentinel, ngx_rbtree_insert_value);
+#ifdef TIMER_USE_POOL
+    if (mem_pool_create_once(&entry_pool, sizeof(timer_entry_t), TIMER_POOL_SLAB, TIMER_POOL_FLAGS) == NULL) {
+        free(T);
+        return NULL;
+    }
+#endif
+    return T;
+}
+
+
+void rb_timer_destroy(rb_timer_t *T) {  // 释放实例以及其中尚未到期的定时器
+    ngx_rbtree_node_t *node, *next;
+    for (node = ngx_rbtree_detach_le(&T->tree, (ngx_rbtree_key_t)-1); node != NULL; node = next) {
+        next = node->right;
+        timer_pool_free(entry_pool, (timer_entry_t *) ((char *)node - offsetof(timer_entry_t, rbnode)));
+    }
+    free(T);
+}
+
+#ifdef TIMER_USE_POOL
+void get_pool_stats(mem_pool_stats_t *st) {
+    mem_pool_stats(entry_pool, st);
+}
+#endif
+
+timer_entry_t* rb_timer_add(rb_timer_t *T, uint32_t msec, timer_handler_pt func) {  // 向红黑树添加一个定时任务，指定 超时时间 和任务的 回调函数 
+    timer_entry_t *te = timer_pool_alloc(entry_pool, timer_entry_t);
+    if (te == NULL)
+        return NULL;
+    memset(te, 0, sizeof(*te));
+    
+    te->handler = func;
+    msec += current_time();
+    te->rbnode.key = msec;
+    ngx_rbtree_insert(&T->tree, &te->rbnode);  // 固定超时的定时器 key 通常最大，直接挂到最右节点下，不用从根查找
+
+    return te;
+}
+
+
+timer_entry_t* rb_timer_add_periodic(rb_timer_t *T, uint32_t interval, timer_handler_pt func, int mode) {  // 周期定时任务，回调之后节点原地重新插入，直到 del_timer
+    timer_entry_t *te = rb_timer_add(T, interval, func);
+    if (te == NULL)
+        return NULL;
+    te->interval = interval;
+    te->mode = mode;
+
+    return te;
+}
+
+
+void rb_timer_del(rb_timer_t *T, timer_entry_t *te) {
+    if (te->firing) {  // 回调中取消自己或同一批到期的定时器，由 expire_timer 负责释放
+        te->cancel = 1;
+        return;
+    }
+    ngx_rbtree_delete(&T->tree, &te->rbnode);
+    timer_pool_free(entry_pool, te);
+}
+
+
+int rb_timer_nearest(rb_timer_t *T) {
+    ngx_rbtree_node_t *node = ngx_rbtree_leftmost(&T->tree);  // O(1)，不用每次从根节点向左查找
+    if (node == NULL) {
+        return -1;
+    }
+    int diff = (int)node->key - (int)current_time();
+
+    return diff > 0 ? diff : 0;
+}
+
+
+void rb_timer_expire(rb_timer_t *T) {
+    timer_entry_t *te;
+    ngx_rbtree_node_t *node, *list, *next;
+    uint32_t now = current_time();
+    // 一次性摘下所有 key <= now 的节点，避免逐个删除时反复做删除修正
+    list = ngx_rbtree_detach_le(&T->tree, now);
+    // 先把整批标记为 firing，回调里 del_timer 同批的定时器时只打标记，不会去树上删除
+    for (node = list; node != NULL; node = node->right) {
+        te = (timer_entry_t *) ((char *)node - offsetof(timer_entry_t, rbnode));
+        te->firing = 1;
+    }
+    for (node = list; node != NULL; node = next) {
+        next = node->right;  // 重新插入会改写 right
+        te = (timer_entry_t *) ((char *)node - offsetof(timer_entry_t, rbnode));
+        if (!te->cancel) {
+            te->handler(te);
+        }
+        te->firing = 0;
+        if (!te->cancel && te->interval) {
+            node->key = (te->mode == TIMER_FIXED_DELAY ? current_time() : node->key) + te->interval;
+            ngx_rbtree_insert(&T->tree, node);
+            continue;
+        }
+        timer_pool_free(entry_pool, te);
+    }
+}
+
+/* 默认实例，兼容原来的全局接口 */
+static rb_timer_t *default_timer;
+
+ngx_rbtree_t* init_timer() {
+    default_timer = rb_timer_create();
+    return &default_timer->tree;
+}
+
+timer_entry_t* add_timer(uint32_t msec, timer_handler_pt func) {
+    return rb_timer_add(default_timer, msec, func);
+}
+
+timer_entry_t* add_periodic_timer(uint32_t interval, timer_handler_pt func, int mode) {
+    return rb_timer_add_periodic(default_timer, interval, func, mode);
+}
+
+void del_timer(timer_entry_t *te) {
+    rb_timer_del(default_timer, te);
+}
+
+int find_nearst_expire_timer() {
+    return rb_timer_nearest(default_timer);
+}
+
+void expire_timer() {
+    rb_timer_expire(default_timer);
+}
+
 #endif
\ No newline at end of file
@@ -1,50 +1,207 @@
-#ifndef SPINLOCK_H
-#define SPINLOCK_H
-
-
-typedef struct spinlock {  // 自定义自旋锁变量
-	int lock;
-} spinlock_t;
-
-
-void spinlock_init(spinlock_t *lock) { // 初始化自旋锁，将 lock 设为 0，表示解锁状态
-	lock->lock = 0;
-}
-
-void spinlock_lock(spinlock_t *lock) {
-	
-	while (__sync_lock_test_and_set(&lock->lock, 1)) {}
-	
-	/**
-	 * 1.尝试获取锁。使用 GCC 内建的 __sync_lock_test_and_set 原子操作设置 lock->lock 为 1
-	 * 
-	 * 2.如果 lock->lock 已经是 1，则表示锁已被其他线程持有，当前线程会在 while 循环中忙等待，直到获取锁成功
-	 * 
-	 */
-}
-
-int spinlock_trylock(spinlock_t *lock) {
-
-	return __sync_lock_test_and_set(&lock->lock, 1) == 0;
-
-	/**
-	 * 1.尝试获取锁，但不会阻塞
-	 * 
-	 * 2. 如果获取锁成功，则返回 1（true）；否则返回 0（false）
-	 */
-}
-
-void spinlock_unlock(spinlock_t *lock) {
-
-	__sync_lock_release(&lock->lock);
-
-	/**
-	 *  释放锁。使用 GCC 内建的 __sync_lock_release 原子操作将 lock->lock 设置为 0 
-	 */
-}
-
-void spinlock_destroy(spinlock_t *lock) {  // 暂时没有作用
-	(void) lock;
-}
-
-#endif
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include <sched.h>
+
+/*
+ * 自旋锁，编译时选择实现：
+ *   默认：test-and-test-and-set，先只读等待锁变为 0 再尝试原子交换，等待时 pause 并指数退避，
+ *         减少抢锁时对 cache line 的争夺
+ *   -DSPINLOCK_TICKET：排号锁，按到达顺序获得锁，推进时间轮的线程不会被大量 add / del 饿死；
+ *         排在前面的线程被调度出去时后面的线程都要等它，线程数多于 CPU 时不如默认实现
+ *   -DSPINLOCK_STATS：统计加锁次数、发生竞争的次数、自旋次数和最长等待时间，由 spinlock_stats 读取
+ * 全零即为未加锁状态，静态变量不必调用 spinlock_init
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define spinlock_pause() _mm_pause()
+#elif defined(__aarch64__)
+#define spinlock_pause() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define spinlock_pause() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#ifndef SPINLOCK_BACKOFF_MAX
+#define SPINLOCK_BACKOFF_MAX 1024 // 一次退避最多 pause 的次数，退避已到上限仍拿不到锁时让出 CPU
+#endif
+
+#ifdef SPINLOCK_STATS
+#include <time.h>
+
+typedef struct spinlock_stats_s {
+	uint64_t acquisitions;  // 加锁成功的次数
+	uint64_t contended;     // 第一次尝试没有拿到锁的次数
+	uint64_t spins;         // 等待期间 pause 的总次数
+	uint64_t max_wait_ns;   // 单次加锁的最长等待时间
+} spinlock_stats_t;
+
+static inline uint64_t spinlock_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+typedef struct spinlock {  // 自定义自旋锁变量
+#ifdef SPINLOCK_TICKET
+	uint32_t next;   // 下一个发放的号
+	uint32_t owner;  // 当前持有锁的号
+#else
+	int lock;
+#endif
+#ifdef SPINLOCK_STATS
+	spinlock_stats_t stats;  // 持有锁时更新
+#endif
+} spinlock_t;
+
+
+static inline void spinlock_init(spinlock_t *lock) { // 初始化自旋锁，表示解锁状态
+#ifdef SPINLOCK_TICKET
+	lock->next = 0;
+	lock->owner = 0;
+#else
+	lock->lock = 0;
+#endif
+#ifdef SPINLOCK_STATS
+	lock->stats.acquisitions = 0;
+	lock->stats.contended = 0;
+	lock->stats.spins = 0;
+	lock->stats.max_wait_ns = 0;
+#endif
+}
+
+#ifdef SPINLOCK_STATS
+static inline void spinlock_account(spinlock_t *lock, uint64_t spins, uint64_t start) { // 拿到锁之后调用，start 为 0 表示没有等待
+	uint64_t wait;
+	lock->stats.acquisitions++;
+	if (start == 0)
+		return;
+	wait = spinlock_now_ns() - start;
+	lock->stats.contended++;
+	lock->stats.spins += spins;
+	if (wait > lock->stats.max_wait_ns)
+		lock->stats.max_wait_ns = wait;
+}
+#endif
+
+#ifdef SPINLOCK_TICKET
+
+static inline void spinlock_lock(spinlock_t *lock) {
+	uint32_t me = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+	uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+	uint64_t spins = 0;
+#ifdef SPINLOCK_STATS
+	uint64_t start = owner == me ? 0 : spinlock_now_ns();
+#endif
+	while (owner != me) {
+		// 前面还有 me - owner 个线程，按排队长度等待，避免所有线程同时读 owner
+		uint32_t n = (me - owner) * 32, i;
+		if (n > SPINLOCK_BACKOFF_MAX)
+			n = SPINLOCK_BACKOFF_MAX;
+		// 等得太久，持有者或排在前面的线程可能被调度出去了；线程数多于 CPU 时不让出会一直空转
+		if (spins >= SPINLOCK_BACKOFF_MAX)
+			sched_yield();
+		for (i = 0; i < n; i++)
+			spinlock_pause();
+		spins += n;
+		owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+	}
+#ifdef SPINLOCK_STATS
+	spinlock_account(lock, spins, start);
+#endif
+}
+
+static inline int spinlock_trylock(spinlock_t *lock) {
+	uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+	uint32_t next = owner;
+	// 没有人排队时 next == owner，取号成功即拿到锁
+	if (!__atomic_compare_exchange_n(&lock->next, &next, owner + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+#ifdef SPINLOCK_STATS
+	spinlock_account(lock, 0, 0);
+#endif
+	return 1;
+}
+
+static inline void spinlock_unlock(spinlock_t *lock) {
+	// 只有持有者会修改 owner
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+static inline void spinlock_lock(spinlock_t *lock) {
+	uint32_t backoff = 1, i;
+#ifdef SPINLOCK_STATS
+	uint64_t spins = 0, start = 0;
+#endif
+	/**
+	 * 1.尝试获取锁。使用 __atomic_exchange_n 将 lock->lock 设置为 1，返回 0 表示获取成功
+	 *
+	 * 2.失败后只读等待 lock->lock 变为 0，读操作命中本地 cache，不会反复让其他核的 cache line 失效
+	 *
+	 * 3.每次看到锁被占用就 pause 若干次，次数指数增长到 SPINLOCK_BACKOFF_MAX，错开各线程再次抢锁的时间
+	 */
+	while (__atomic_exchange_n(&lock->lock, 1, __ATOMIC_ACQUIRE)) {
+#ifdef SPINLOCK_STATS
+		if (start == 0)
+			start = spinlock_now_ns();
+#endif
+		do {
+			for (i = 0; i < backoff; i++)
+				spinlock_pause();
+#ifdef SPINLOCK_STATS
+			spins += backoff;
+#endif
+			if (backoff < SPINLOCK_BACKOFF_MAX)
+				backoff <<= 1;
+			else
+				sched_yield();  // 持有者可能被调度出去了
+		} while (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED));
+	}
+#ifdef SPINLOCK_STATS
+	spinlock_account(lock, spins, start);
+#endif
+}
+
+static inline int spinlock_trylock(spinlock_t *lock) {
+
+	/**
+	 * 1.尝试获取锁，但不会阻塞；锁已被占用时先只读判断，不做原子交换
+	 *
+	 * 2. 如果获取锁成功，则返回 1（true）；否则返回 0（false）
+	 */
+	if (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED) || __atomic_exchange_n(&lock->lock, 1, __ATOMIC_ACQUIRE))
+		return 0;
+#ifdef SPINLOCK_STATS
+	spinlock_account(lock, 0, 0);
+#endif
+	return 1;
+}
+
+static inline void spinlock_unlock(spinlock_t *lock) {
+
+	__atomic_store_n(&lock->lock, 0, __ATOMIC_RELEASE);
+
+	/**
+	 *  释放锁。使用 release 语义的原子写将 lock->lock 设置为 0，临界区内的写操作在此之前对其他线程可见
+	 */
+}
+
+#endif
+
+#ifdef SPINLOCK_STATS
+static inline void spinlock_stats(spinlock_t *lock, spinlock_stats_t *st) { // 读取时短暂持有锁，这次加锁也会计入
+	spinlock_lock(lock);
+	*st = lock->stats;
+	spinlock_unlock(lock);
+}
+#endif
+
+static inline void spinlock_destroy(spinlock_t *lock) {  // 暂时没有作用
+	(void) lock;
+}
+
+#endif
@@ -1,253 +1,1539 @@
-#include "spinlock.h"
-#include "timewheel.h"
-#include <string.h>
-#include <stddef.h>
-#include <stdlib.h>
-
-#if defined(__APPLE__)
-#include <AvailabilityMacros.h>
-#include <sys/time.h>
-#include <mach/task.h>
-#include <mach/mach.h>
-#else
-#include <time.h>
-#endif
-
-typedef struct link_list { // 链表结构体
-    timer_node_t head;  // 链表头节点
-    timer_node_t *tail; // 链表尾节点的地址
-} link_list_t;
-
-typedef struct timer {  // 定时器结构体
-    link_list_t near[TIME_NEAR]; // 最小精度时间轮
-    link_list_t t[4][TIME_LEVEL]; // 四层时间轮
-    struct spinlock lock;
-    uint32_t time;    // 定时器内部时间
-    uint64_t current; 
-    uint64_t current_point; // 系统时间（已过期）
-} s_timer_t;
-
-
-static s_timer_t * TI = NULL;   // 全局定时器
-
-
-timer_node_t * link_clear(link_list_t *list) { // 取出当前链表（先存副本再移除）
-    timer_node_t *ret = list->head.next;
-    list->head.next = 0;      // 头节点head作占位符，实际第一个节点在head.next的位置
-    list->tail = &(list->head);
-
-    return ret;
-}
-
-
-void link(link_list_t *list, timer_node_t *node) { // 尾插法，将新节点插入链表
-    list->tail->next = node;
-    list->tail = node;
-    node->next = 0;
-}
-
-
-void add_node(s_timer_t *T, timer_node_t *node) {
-    uint32_t time = node->expire; // 定时任务的绝对超时时间
-    uint32_t current_time = T->time; // 定时器内部当前时间
-    uint32_t msec = time - current_time; // 定时任务的相对超时时间
-
-    if (msec < TIME_NEAR) { // [0，256） 2的8次幂
-        link(&T->near[msec], node);
-    } 
-    else if (msec < (1 << (TIME_NEAR_SHIFT + TIME_LEVEL_SHIFT))) { // [256, 16384)   2的14次幂
-        link(&T->t[0][((msec >> TIME_NEAR_SHIFT) & TIME_LEVEL_MASK)], node); // 先右移8位（除以256）再对64取模
-    } 
-    else if (msec < (1 << (TIME_NEAR_SHIFT + 2*TIME_LEVEL_SHIFT))) { // [16384, 1048576)  2的20次幂
-        link(&T->t[1][(msec >> (TIME_NEAR_SHIFT + TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK], node); // 先右移14位 ， 再对64取模
-    }
-    else if (msec < (1 << (TIME_NEAR_SHIFT + 3*TIME_LEVEL_SHIFT))) { // [1048576, 67108864)  2的26次幂
-        link(&T->t[2][(msec >> (TIME_NEAR_SHIFT + 2*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK], node); // 先右移20位 ， 再对64取模
-    }
-    else { // [67108864, 4294967295] 
-        link(&T->t[2][(msec >> (TIME_NEAR_SHIFT + 3*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK], node); // 先右移26位 ， 再对64取模
-    }
-    // 实际上中间三个link的取模运算都是多余的
-}
-
-
-timer_node_t * add_timer(int time, handler_pt func, int threadid) { // 添加一个定时任务
-    
-    timer_node_t *node = (timer_node_t *)malloc(sizeof(*node));
-    spinlock_lcok(&TI->lock);
-    node->expire = time+TI->time;
-    node->callback = func;
-    node->id = threadid;
-
-    if (time <= 0) {  // 如果是立即执行的任务，则立即执行
-        spinlock_unlock(&TI->lock);
-        node->callback(node);
-        free(node);
-        return NULL;
-    }
-    add_node(TI, node);
-    spinlock_unlock(&TI->lock);
-    
-    return node;
-}
-
-
-void move_list(s_timer_t *T, int level, int idx) { // 更新一个链表所有节点的位置
-    timer_node_t *current = link_clear(&T->t[level][idx]);
-    while (current) {
-        timer_node_t *temp = current->next;
-        add_node(T, current);
-        current = temp;
-    }
-}
-
-
-void timer_shift(s_timer_t *T) {  // 推进时间轮内部时间增长
-    
-    int mask = TIME_NEAR;
-    uint32_t ct = ++T->time; // ct是当前时间，然后将定时器内部时间 + 1
-    if (ct == 0) {  // 时间轮循环了一整圈，约 12.4 天
-        move_list(T, 3, 0);
-    } else {  // 每256秒检查一次是否需要重新映射节点
-        uint32_t time = ct >> TIME_NEAR_SHIFT; // 除以256
-        int i = 0;
-        // 每2的8次幂（256）、14次幂、20次幂、26次幂 重新映射一次节点
-        while ((ct & (mask-1)) == 0) { // 对2的8次幂、14次幂、20次幂、26次幂取模
-            int idx = time & TIME_LEVEL_MASK; // 对64取模
-            if (idx != 0) {
-                move_list(T, i, idx); // 重新映射节点
-                break;
-            }
-            mask <<= TIME_LEVEL_SHIFT;
-            time >>= TIME_LEVEL_SHIFT;
-            ++i;
-        }
-    }
-}
-
-
-void dispath_list(timer_node_t *current) { // 执行一个链表的任务
-    do {
-        timer_node_t *temp = current;
-        current = current->next;
-        if (temp->cancel == 0)
-            temp->callback(temp);
-        free(temp);
-    } while (current);
-}
-
-
-void timer_execute(s_timer_t *T) {  //  执行最小精度时间轮near的一个任务链表
-    int idx = T->time & TIME_NEAR_MASK;
-
-    while (T->near[idx].head.next) {
-        timer_node_t *current = link_clear(&T->near[idx]);
-        spinlock_unlock(&T->lock);
-        dispath_list(current);
-        spinlock_lock(&T->lock);
-    }
-}
-
-
-void timer_update(s_timer_t *T) {  
-    spinlock_lock(&T->lock);
-    timer_execute(T);   // 执行当前槽中所有节点
-    timer_shift(T);     // 将时间轮推进一个单位时间，并将需要重新映射的节点移到合适的时间槽中
-    timer_execute(T);   // 处理由于时间轮转动后可能落入当前时间槽的新定时器节点
-    spinlock_unlock(&T->lock);
-}
-
-
-void del_timer(timer_node_t *node) { // 删除一个任务节点，这个任务会被删除而不执行
-    node->cancel = 1;
-}
-
-
-s_timer_t* timer_create_timer() {
-    
-    s_timer_t *r = (s_timer_t *)malloc(sizeof(s_timer_t));
-    memset(r, 0, sizeof(*r));
-    
-    int i, j;
-    for (i = 0; i < TIME_NEAR; i++) {
-        link_clear(&r->near[i]);
-    }
-    for (i = 0; i < 4; i++) {
-        for(j = 0; j < 4; j++) {
-            link_clear(&r->t[i][j]);
-        }
-    }
-    spinlock_init(&r->lock);
-    r->current = 0;
-
-    return r;
-}
-
-
-uint64_t gettime() {  // 获取系统时间
-    uint64_t t;
-#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
-	struct timespec ti;
-	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 1000;
-	t += ti.tv_nsec / 1000000;
-	// 1ns = 1/1000000000 s = 1/1000000 ms
-#else
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
-#endif
-
-    return t;
-}
-
-
-void expire_timer(void) {   // 以系统时间为参照，推动定时器
-    uint64_t cp = gettime();
-    if (cp != TI->current_point) {
-        uint32_t diff = (uint32_t)(cp - TI->current_point); // 距离上一次更新的时长
-        TI->current_point = cp;
-        int i;
-        for (i = 0; i < diff; i++) { // 补偿时差
-            timer_update(TI);
-        }
-    }
-}
-
-
-void 
-init_timer(void) {
-	TI = timer_create_timer();
-	TI->current_point = gettime();
-}
-
-
-void clear_timer() {   // 销毁定时器
-    int i, j;
-    for (i = 0; i < TIME_NEAR; i++) {  // 遍历释放near所有的链表的节点空间
-        link_list_t *list = &TI->near[i];
-        timer_node_t *current = list->head.next;
-        while (current) {
-            timer_node_t *temp = current;
-            current = current->next;
-            free(temp);
-        }
-        link_clear(&TI->near[i]); // 避免悬空指针
-    }
-    for (i = 0; i < 4; i++) {   // 遍历释放二维指针数组t的所有链表空间
-        for (j = 0; j < TIME_LEVEL; j++) {
-            link_list_t *list = &TI->t[i][j];
-            timer_node_t *current = list->head.next;
-            while (current) {
-                timer_node_t *temp = current;
-                current = current->next;
-                free(temp);
-            }
-            link_clear(&TI->t[i][j]);
-        }
-    }
-}
-
-
-
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // sched_getcpu
+#endif
+#include "spinlock.h"
+#include "timewheel.h"
+#include "mempool.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+#if defined(__APPLE__)
+#include <AvailabilityMacros.h>
+#include <sys/time.h>
+#include <mach/task.h>
+#include <mach/mach.h>
+#else
+#include <time.h>
+#endif
+
+#define TIMER_NODE_QUEUED 0 // 在提交队列中，尚未放入时间轮
+#define TIMER_NODE_LINKED 1 // 挂在某个槽位的链表上
+#define TIMER_NODE_FIRING 2 // 已从槽位取出，等待或正在执行回调
+
+#define TIMER_LEVEL_HRES 0xff // node->level：节点属于高精度时间轮，expire 为高精度 tick 的低 32 位
+
+typedef struct link_list { // 链表结构体，双向循环链表
+    timer_node_t head;  // 哨兵节点，空链表时 head.next == head.prev == &head
+} link_list_t;
+
+/*
+ * 提交队列：Vyukov 无锁多生产者单消费者队列，节点复用 timer_node_t 的 next 指针
+ *   add_timer 只做一次原子交换把节点挂到 head，不再和推进时间轮的线程争抢 T->lock
+ *   timer_advance 每次推进前由持有 T->lock 的线程从 tail 一端取出，放入时间轮
+ */
+typedef struct mpsc_queue {
+    timer_node_t *head __attribute__((aligned(64))); // 生产者一端
+    timer_node_t *tail __attribute__((aligned(64))); // 消费者一端
+    timer_node_t stub;
+} mpsc_queue_t;
+
+/*
+ * 工作线程：tw_timer_start_workers 之后到期的节点不在推进线程上执行回调，
+ *   而是按 node->id 交给固定的工作线程，每个工作线程一个有界的单生产者单消费者环形队列
+ *   生产者是推进时间轮的线程，一个槽位的节点全部入队之后每个收到节点的工作线程只 sem_post 一次
+ */
+typedef struct timer_task {
+    timer_node_t *node;
+    uint64_t enqueued;  // 入队时的系统时间（微秒），用于统计派发延迟
+} timer_task_t;
+
+typedef struct timer_worker {
+    s_timer_t *T;
+    pthread_t tid;
+    sem_t sem;
+    timer_task_t *ring;
+    uint32_t mask;      // 容量 - 1，容量为 2 的幂
+    uint32_t batch;     // 本批次新入队的个数，只由生产者读写
+    int stop;
+    uint32_t head __attribute__((aligned(64))); // 消费者一端
+    uint32_t tail __attribute__((aligned(64))); // 生产者一端
+    timer_worker_stats_t stats; // dispatched / queue_full / depth_max 由生产者更新，其余由工作线程更新
+} timer_worker_t;
+
+#if TIME_LEVEL != 64
+#error "level_bits 每层只用一个 uint64_t，TIME_LEVEL_SHIFT 必须为 6"
+#endif
+
+struct timer {  // 定时器结构体，s_timer_t
+    link_list_t near[TIME_NEAR]; // 最小精度时间轮
+    link_list_t t[4][TIME_LEVEL]; // 四层时间轮
+    uint64_t near_bits[TIME_NEAR / 64]; // 非空槽位的位图，追赶时用 ctz 直接找到下一个非空槽
+    uint64_t level_bits[4];
+    link_list_t (*wheel)[TIME_LVL_SIZE]; // TIMER_NO_CASCADE 时使用的分层时间轮，此时 near / t 不再使用
+    uint64_t wheel_bits[TIME_LVL_DEPTH];
+    struct spinlock lock;
+    int flags;        // TIMER_UNLOCKED 时不使用 lock 和提交队列
+    uint32_t time;    // 定时器内部时间
+    uint64_t current; 
+    uint64_t current_point; // 系统时间（已过期）
+    uint64_t origin;  // 内部时间为 0 时对应的系统时间
+    mpsc_queue_t pending; // 尚未放入时间轮的新节点
+    timer_stats_t stats;  // 持有 lock 时更新
+    timer_worker_t *workers; // 为 NULL 时回调在推进线程上执行
+    int nworkers;
+    uint16_t shard;  // 在分片时间轮中的下标，新节点记录它，单独创建的实例为 0
+    link_list_t *hres;        // 高精度时间轮，tw_timer_set_hires 之后才分配
+    uint64_t hres_bits[TIME_HRES / 64];
+    uint64_t hres_time;       // 高精度时间轮已处理到的 tick：CLOCK_MONOTONIC 纳秒 / TIME_HRES_NS
+    int hres_threshold;       // 微秒，tw_timer_add_us 的延迟小于它时放入高精度时间轮
+};
+
+struct tw_sharded {  // 分片时间轮，tw_sharded_t
+    int nshards;
+    s_timer_t **shards;
+};
+
+
+static s_timer_t * TI = NULL;   // 默认实例，供不带 tw_timer_ 前缀的全局接口使用
+static tw_sharded_t * TS = NULL; // init_timer_sharded 之后全局接口改为操作分片时间轮，TI 为其中的 0 号分片
+
+uint64_t gettime();
+static uint64_t gettime_ns();
+static s_timer_t* shard_of(tw_sharded_t *S, int threadid);
+
+#ifdef TIMER_USE_POOL
+static mem_pool_t *node_pool;   // timer_node_t 对象池
+#endif
+
+
+static inline void timer_lock(s_timer_t *T) {
+    if (!(T->flags & TIMER_UNLOCKED))
+        spinlock_lock(&T->lock);
+}
+
+
+static inline void timer_unlock(s_timer_t *T) {
+    if (!(T->flags & TIMER_UNLOCKED))
+        spinlock_unlock(&T->lock);
+}
+
+
+void link_init(link_list_t *list) {
+    list->head.next = &list->head;
+    list->head.prev = &list->head;
+}
+
+
+timer_node_t * link_clear(link_list_t *list) { // 取出当前链表，返回以 NULL 结尾、只用 next 串起来的节点
+    timer_node_t *ret = NULL;
+    if (list->head.next != &list->head) {
+        ret = list->head.next;
+        list->head.prev->next = NULL;
+    }
+    link_init(list);      // 头节点head作占位符，实际第一个节点在head.next的位置
+
+    return ret;
+}
+
+
+void link(link_list_t *list, timer_node_t *node) { // 尾插法，将新节点插入链表
+    node->prev = list->head.prev;
+    node->next = &list->head;
+    list->head.prev->next = node;
+    list->head.prev = node;
+}
+
+
+static void link_unlink(timer_node_t *node) { // O(1) 从所在链表摘除
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+
+static int link_empty(link_list_t *list) {
+    return list->head.next == &list->head;
+}
+
+
+static void mpsc_init(mpsc_queue_t *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+
+static void mpsc_push(mpsc_queue_t *q, timer_node_t *node) {  // 任意线程调用，无锁
+    node->next = NULL;
+    timer_node_t *prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);  // 在此之前 prev 与 node 之间短暂断开
+}
+
+
+static void mpsc_push_chain(mpsc_queue_t *q, timer_node_t *first, timer_node_t *last) {  // 一次交换挂上一串已经用 next 连好的节点
+    last->next = NULL;
+    timer_node_t *prev = __atomic_exchange_n(&q->head, last, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, first, __ATOMIC_RELEASE);
+}
+
+
+static timer_node_t * mpsc_pop(mpsc_queue_t *q) {  // 只能由一个线程调用，队列为空或生产者尚未链接完成时返回 NULL
+    timer_node_t *tail = q->tail;
+    timer_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub) {
+        if (next == NULL)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    mpsc_push(q, &q->stub);  // tail 是最后一个节点，放回 stub 后才能把它取出
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+
+/*
+ * TIMER_NO_CASCADE：参照 Linux 4.8 之后的定时器时间轮，节点放入后不再移动
+ *   第 n 层每个槽覆盖 8^n 个 tick，距离超时时间 delta 在 [63*8^(n-1), 63*8^n) 的节点放入第 n 层，
+ *   槽位按超时时间向上取整到 8^n 的倍数，只在 tick 是 8^n 的倍数时执行该层的当前槽，
+ *   因此不会提前执行，最多推迟 8^n - 1 个 tick，不超过 delta 的 1/7.875
+ *   delta 超过最高层范围（约 12 天）的节点先放在最高层最远的槽，到时发现未到期再重新放入
+ */
+#define LVL_SHIFT(n)  ((n) * TIME_LVL_CLK_SHIFT)
+#define LVL_GRAN(n)   (1u << LVL_SHIFT(n))
+#define LVL_START(n)  ((uint32_t)(TIME_LVL_SIZE - 1) << LVL_SHIFT((n) - 1))
+#define LVL_MAX_DELTA (LVL_START(TIME_LVL_DEPTH) - 1)
+
+static void lvl_add_node(s_timer_t *T, timer_node_t *node) {
+    uint32_t ct = T->time, delta, idx;
+    int lvl;
+
+    if ((int32_t)(node->expire - ct) < 0)
+        node->expire = ct;
+    delta = node->expire - ct;
+    node->state = TIMER_NODE_LINKED;
+    if (delta < LVL_START(1)) {
+        lvl = 0;
+        idx = node->expire & (TIME_LVL_SIZE - 1);
+    } else {
+        if (delta > LVL_MAX_DELTA)
+            delta = LVL_MAX_DELTA;
+        for (lvl = 1; lvl < TIME_LVL_DEPTH - 1 && delta >= LVL_START(lvl + 1); lvl++) {}
+        // 向上取整；回绕时高位被截掉，每层 64 个槽的周期整除 2^32，下标仍然正确
+        idx = (uint32_t)(((uint64_t)(uint32_t)(ct + delta) + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl)) & (TIME_LVL_SIZE - 1);
+    }
+    node->level = lvl;
+    link(&T->wheel[lvl][idx], node);
+    T->wheel_bits[lvl] |= 1ull << idx;
+}
+
+
+static void lvl_unlink_node(s_timer_t *T, timer_node_t *node) {
+    if (node->next == node->prev) {  // 槽位中只有这一个节点，next 就是链表头，由它算出槽位下标
+        int idx = (int)((link_list_t *)node->next - T->wheel[node->level]);
+        T->wheel_bits[node->level] &= ~(1ull << idx);
+    }
+    link_unlink(node);
+}
+
+
+/*
+ * 高精度时间轮：节点按绝对高精度 tick 放入 expire & TIME_HRES_MASK 的槽
+ *   延迟不超过一圈，正常情况下槽位与超时时间一一对应；推进线程长时间没有推进时，
+ *   新节点可能比当前时间领先超过一圈，执行时发现未到期的节点留在原槽，下一圈再执行
+ */
+static void hres_add_node(s_timer_t *T, timer_node_t *node) {
+    uint32_t ct = (uint32_t)T->hres_time;
+    int idx;
+
+    if ((int32_t)(node->expire - ct) < 0)  // 提交之后时间轮已推进过超时时间，放到当前槽
+        node->expire = ct;
+    idx = node->expire & TIME_HRES_MASK;
+    node->state = TIMER_NODE_LINKED;
+    link(&T->hres[idx], node);
+    T->hres_bits[idx >> 6] |= 1ull << (idx & 63);
+}
+
+
+static void hres_unlink_node(s_timer_t *T, timer_node_t *node) {
+    int idx = node->expire & TIME_HRES_MASK;
+    link_unlink(node);
+    if (link_empty(&T->hres[idx]))
+        T->hres_bits[idx >> 6] &= ~(1ull << (idx & 63));
+}
+
+
+void add_node(s_timer_t *T, timer_node_t *node) {
+    if (node->level == TIMER_LEVEL_HRES) {
+        hres_add_node(T, node);
+        return;
+    }
+    if (T->wheel) {
+        lvl_add_node(T, node);
+        return;
+    }
+    uint32_t current_time = T->time; // 定时器内部当前时间
+    // 已经过期的节点（提交后时间轮已推进，或固定频率任务落后）放到当前槽，本次 timer_execute 执行
+    if ((int32_t)(node->expire - current_time) < 0)
+        node->expire = current_time;
+    uint32_t time = node->expire; // 定时任务的绝对超时时间
+
+    // 槽位按绝对时间划分：timer_execute 执行的是 near[T->time & TIME_NEAR_MASK]
+    node->state = TIMER_NODE_LINKED;
+    if ((time | TIME_NEAR_MASK) == (current_time | TIME_NEAR_MASK)) { // 与当前时间处在同一个 256 区间内
+        int idx = time & TIME_NEAR_MASK;
+        node->level = 0;
+        link(&T->near[idx], node);
+        T->near_bits[idx >> 6] |= 1ull << (idx & 63);
+    } else { // 找到第一个高位与当前时间相同的层级，下标取该层对应的 6 位
+        int i;
+        uint32_t mask = TIME_NEAR << TIME_LEVEL_SHIFT;
+        for (i = 0; i < 3; i++) {
+            if ((time | (mask - 1)) == (current_time | (mask - 1)))
+                break;
+            mask <<= TIME_LEVEL_SHIFT;
+        }
+        int idx = (time >> (TIME_NEAR_SHIFT + i * TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK;
+        node->level = i + 1;
+        link(&T->t[i][idx], node);
+        T->level_bits[i] |= 1ull << idx;
+    }
+}
+
+
+static void unlink_node(s_timer_t *T, timer_node_t *node) { // 从槽位摘除，槽位变空时清除位图
+    int i, idx;
+    if (node->level == TIMER_LEVEL_HRES) {
+        hres_unlink_node(T, node);
+        return;
+    }
+    if (T->wheel) {
+        lvl_unlink_node(T, node);
+        return;
+    }
+    link_unlink(node);
+    if (node->level == 0) {
+        idx = node->expire & TIME_NEAR_MASK;
+        if (link_empty(&T->near[idx]))
+            T->near_bits[idx >> 6] &= ~(1ull << (idx & 63));
+    } else {
+        i = node->level - 1;
+        idx = (node->expire >> (TIME_NEAR_SHIFT + i * TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK;
+        if (link_empty(&T->t[i][idx]))
+            T->level_bits[i] &= ~(1ull << idx);
+    }
+}
+
+
+static void drain_pending(s_timer_t *T) {  // 持有 T->lock 时调用，把提交队列中的节点放入时间轮
+    timer_node_t *node;
+    while ((node = mpsc_pop(&T->pending)) != NULL) {
+        if (node->cancel) {  // 还没进入时间轮就被取消
+            T->stats.removed++;
+            T->stats.removed_bytes += sizeof(timer_node_t);
+            timer_pool_free(node_pool, node);
+            continue;
+        }
+        add_node(T, node);  // 生产者读取 T->time 之后时间轮可能已经推进，由 add_node 放到当前槽
+    }
+}
+
+
+static void submit_node(s_timer_t *T, timer_node_t *node) {
+    if (T->flags & TIMER_UNLOCKED) {  // 只有所属线程会访问，直接放入时间轮
+        add_node(T, node);
+        return;
+    }
+    mpsc_push(&T->pending, node);  // 不加锁，下一次推进时放入时间轮
+}
+
+
+timer_node_t * tw_timer_add(s_timer_t *T, int time, handler_pt func, int threadid) { // 添加一个定时任务
+    
+    timer_node_t *node = timer_pool_alloc(node_pool, timer_node_t);
+    if (node == NULL)
+        return NULL;
+    node->expire = time + __atomic_load_n(&T->time, __ATOMIC_RELAXED);
+    node->callback = func;
+    node->cancel = 0;
+    node->state = TIMER_NODE_QUEUED;
+    node->id = threadid;
+    node->shard = T->shard;
+    node->interval = 0;
+    node->level = 0;  // 节点可能来自对象池，清掉高精度时间轮的标记
+
+    if (time <= 0) {  // 如果是立即执行的任务，则立即执行
+        node->callback(node);
+        timer_pool_free(node_pool, node);
+        return NULL;
+    }
+    submit_node(T, node);
+    
+    return node;
+}
+
+
+timer_node_t * tw_timer_add_periodic(s_timer_t *T, int interval, handler_pt func, int threadid, int mode) { // 添加一个周期定时任务
+    
+    if (interval <= 0)
+        return NULL;
+    timer_node_t *node = timer_pool_alloc(node_pool, timer_node_t);
+    if (node == NULL)
+        return NULL;
+    node->callback = func;
+    node->cancel = 0;
+    node->state = TIMER_NODE_QUEUED;
+    node->id = threadid;
+    node->shard = T->shard;
+    node->interval = interval;
+    node->mode = mode;
+    node->level = 0;
+
+    node->expire = interval + __atomic_load_n(&T->time, __ATOMIC_RELAXED);
+    submit_node(T, node);
+
+    return node;
+}
+
+
+int tw_timer_set_hires(s_timer_t *T, int threshold_us) {
+    int i;
+    // 延迟向上取整后最多多占一个槽，再留一个槽给当前 tick
+    if (T->hres || threshold_us <= 0 || (uint64_t)threshold_us * 1000 > (uint64_t)(TIME_HRES - 2) * TIME_HRES_NS)
+        return -1;
+    T->hres = (link_list_t *)malloc(TIME_HRES * sizeof(link_list_t));
+    if (T->hres == NULL)
+        return -1;
+    for (i = 0; i < TIME_HRES; i++)
+        link_init(&T->hres[i]);
+    T->hres_time = gettime_ns() / TIME_HRES_NS;
+    T->hres_threshold = threshold_us;
+    return 0;
+}
+
+
+timer_node_t * tw_timer_add_us(s_timer_t *T, int time_us, handler_pt func, int threadid) {
+    uint64_t target;
+    if (time_us <= 0)
+        return tw_timer_add(T, time_us, func, threadid);
+
+    timer_node_t *node = timer_pool_alloc(node_pool, timer_node_t);
+    if (node == NULL)
+        return NULL;
+    // 超时时间按调用线程读到的系统时间计算并向上取整，不会提前执行
+    target = gettime_ns() + (uint64_t)time_us * 1000;
+    if (T->hres && time_us < T->hres_threshold) {
+        node->expire = (uint32_t)((target + TIME_HRES_NS - 1) / TIME_HRES_NS);
+        node->level = TIMER_LEVEL_HRES;
+    } else {  // 毫秒时间轮的内部时间可能落后于系统时间，按绝对时间换算，而不是在 T->time 上加延迟
+        node->expire = (uint32_t)((target + 999999) / 1000000 - T->origin);
+        node->level = 0;
+    }
+    node->callback = func;
+    node->cancel = 0;
+    node->state = TIMER_NODE_QUEUED;
+    node->id = threadid;
+    node->shard = T->shard;
+    node->interval = 0;
+    submit_node(T, node);
+
+    return node;
+}
+
+
+/*
+ * 批量添加：节点一次从对象池取出，用 next 连成一串后只做一次原子交换挂到提交队列，
+ *   TIMER_UNLOCKED 的实例直接逐个放入时间轮
+ * time <= 0 的请求立即执行，对应的 out[i] 为 NULL；节点不够时不添加任何定时器，返回 -1
+ * S 不为 NULL 时每个请求按 id 选择分片，连续落在同一分片的节点一起挂到该分片的提交队列
+ */
+static int add_batch(s_timer_t *T, tw_sharded_t *S, const timer_req_t *reqs, int n, timer_node_t **out) {
+    timer_node_t *first = NULL, *last = NULL;
+    s_timer_t *to;
+    int i, got;
+
+    if (n <= 0)
+        return 0;
+    got = (int)timer_pool_alloc_bulk(node_pool, out, (unsigned)n);
+    if (got < n) {
+        for (i = 0; i < got; i++)
+            timer_pool_free(node_pool, out[i]);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        timer_node_t *node = out[i];
+        to = S ? shard_of(S, reqs[i].id) : T;
+        if (to != T && first) {
+            mpsc_push_chain(&T->pending, first, last);
+            first = last = NULL;
+        }
+        T = to;
+        node->expire = reqs[i].time + __atomic_load_n(&T->time, __ATOMIC_RELAXED);
+        node->callback = reqs[i].callback;
+        node->cancel = 0;
+        node->state = TIMER_NODE_QUEUED;
+        node->id = reqs[i].id;
+        node->shard = T->shard;
+        node->interval = 0;
+        node->level = 0;
+
+        if (reqs[i].time <= 0) {
+            node->callback(node);
+            timer_pool_free(node_pool, node);
+            out[i] = NULL;
+            continue;
+        }
+        if (T->flags & TIMER_UNLOCKED) {
+            add_node(T, node);
+            continue;
+        }
+        if (last)
+            last->next = node;
+        else
+            first = node;
+        last = node;
+    }
+    if (first)
+        mpsc_push_chain(&T->pending, first, last);
+    return 0;
+}
+
+
+int tw_timer_add_batch(s_timer_t *T, const timer_req_t *reqs, int n, timer_node_t **out) {
+    return add_batch(T, NULL, reqs, n, out);
+}
+
+
+void move_list(s_timer_t *T, int level, int idx) { // 更新一个链表所有节点的位置
+    timer_node_t *current = link_clear(&T->t[level][idx]);
+    T->level_bits[level] &= ~(1ull << idx);
+    while (current) {
+        timer_node_t *temp = current->next;
+        add_node(T, current);
+        T->stats.cascaded++;
+        current = temp;
+    }
+}
+
+
+void timer_shift(s_timer_t *T) {  // 推进时间轮内部时间增长
+    
+    int mask = TIME_NEAR;
+    uint32_t ct = T->time + 1; // ct是当前时间，然后将定时器内部时间 + 1
+    __atomic_store_n(&T->time, ct, __ATOMIC_RELAXED); // add_timer 不加锁读取
+    if (ct == 0) {  // 时间轮循环了一整圈，约 12.4 天
+        move_list(T, 3, 0);
+    } else {  // 每256秒检查一次是否需要重新映射节点
+        uint32_t time = ct >> TIME_NEAR_SHIFT; // 除以256
+        int i = 0;
+        // 每2的8次幂（256）、14次幂、20次幂、26次幂 重新映射一次节点
+        while ((ct & (mask-1)) == 0) { // 对2的8次幂、14次幂、20次幂、26次幂取模
+            int idx = time & TIME_LEVEL_MASK; // 对64取模
+            if (idx != 0) {
+                move_list(T, i, idx); // 重新映射节点
+                break;
+            }
+            mask <<= TIME_LEVEL_SHIFT;
+            time >>= TIME_LEVEL_SHIFT;
+            ++i;
+        }
+    }
+}
+
+
+static void fire_node(s_timer_t *T, timer_node_t *node) { // 执行一个节点的回调，周期任务重新插入，其余释放
+    if (node->cancel == 0)
+        node->callback(node);
+    if (node->cancel == 0 && node->interval) { // 周期任务：复用原节点重新插入时间轮
+        timer_lock(T);
+        if (node->mode == TIMER_FIXED_DELAY)
+            node->expire = (uint32_t)(gettime() - T->origin) + node->interval;
+        else
+            node->expire += node->interval;
+        add_node(T, node);
+        timer_unlock(T);
+    } else {
+        timer_pool_free(node_pool, node);
+    }
+}
+
+
+static uint64_t gettime_us() {
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+}
+
+
+static void worker_push(timer_worker_t *w, timer_node_t *node) { // 只由推进线程调用
+    uint32_t tail = w->tail;
+    uint32_t depth = tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+    if (depth > w->mask) {  // 队列已满，唤醒工作线程并等待，不能改在本线程执行，否则同一 id 的回调会乱序
+        __atomic_fetch_add(&w->stats.queue_full, 1, __ATOMIC_RELAXED);
+        sem_post(&w->sem);
+        w->batch = 0;
+        while (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE) > w->mask)
+            sched_yield();
+        depth = tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+    }
+    w->ring[tail & w->mask].node = node;
+    w->ring[tail & w->mask].enqueued = gettime_us();
+    __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+    w->batch++;
+    __atomic_fetch_add(&w->stats.dispatched, 1, __ATOMIC_RELAXED);
+    if (depth + 1 > w->stats.depth_max)
+        __atomic_store_n(&w->stats.depth_max, depth + 1, __ATOMIC_RELAXED);
+}
+
+
+static void * worker_main(void *arg) {
+    timer_worker_t *w = (timer_worker_t *)arg;
+    uint32_t head;
+    uint64_t lag;
+
+    for (;;) {
+        head = w->head;
+        while (head != __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) {
+            timer_task_t task = w->ring[head & w->mask];
+            __atomic_store_n(&w->head, ++head, __ATOMIC_RELEASE);  // 先腾出位置，回调耗时不影响生产者
+            lag = gettime_us() - task.enqueued;
+            __atomic_fetch_add(&w->stats.lag_total_us, lag, __ATOMIC_RELAXED);
+            if (lag > w->stats.lag_max_us)
+                __atomic_store_n(&w->stats.lag_max_us, lag, __ATOMIC_RELAXED);
+            fire_node(w->T, task.node);
+            __atomic_fetch_add(&w->stats.executed, 1, __ATOMIC_RELAXED);
+        }
+        if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)
+            && head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE))
+            break;  // 退出前执行完队列中剩余的节点
+        while (sem_wait(&w->sem) != 0) {}  // 被信号打断时重试
+    }
+    return NULL;
+}
+
+
+void dispath_list(s_timer_t *T, timer_node_t *current) { // 执行一个链表的任务
+    int i;
+    if (T->workers == NULL) {
+        do {
+            timer_node_t *temp = current;
+            current = current->next;
+            fire_node(T, temp);
+        } while (current);
+        return;
+    }
+    do {  // 同一个 id 总是交给同一个工作线程，保持其回调的先后顺序
+        timer_node_t *temp = current;
+        current = current->next;
+        worker_push(&T->workers[(uint32_t)temp->id % (uint32_t)T->nworkers], temp);
+    } while (current);
+    for (i = 0; i < T->nworkers; i++) {
+        if (T->workers[i].batch) {
+            T->workers[i].batch = 0;
+            sem_post(&T->workers[i].sem);
+        }
+    }
+}
+
+
+int tw_timer_start_workers(s_timer_t *T, int nworkers, unsigned queue_cap) {
+    int i;
+    uint32_t cap = 1;
+
+    if ((T->flags & TIMER_UNLOCKED) || T->workers || nworkers <= 0 || queue_cap == 0)
+        return -1;  // 工作线程会重新插入周期任务，实例必须带锁
+    while (cap < queue_cap)
+        cap <<= 1;
+
+    timer_worker_t *ws = (timer_worker_t *)calloc(nworkers, sizeof(timer_worker_t));
+    if (ws == NULL)
+        return -1;
+    for (i = 0; i < nworkers; i++) {
+        timer_worker_t *w = &ws[i];
+        w->T = T;
+        w->mask = cap - 1;
+        w->ring = (timer_task_t *)malloc(cap * sizeof(timer_task_t));
+        if (w->ring == NULL || sem_init(&w->sem, 0, 0) != 0) {
+            free(w->ring);
+            break;
+        }
+        if (pthread_create(&w->tid, NULL, worker_main, w) != 0) {
+            sem_destroy(&w->sem);
+            free(w->ring);
+            break;
+        }
+    }
+    T->workers = ws;
+    T->nworkers = i;
+    if (i < nworkers) {  // 部分线程启动失败，全部撤销
+        tw_timer_stop_workers(T);
+        return -1;
+    }
+    return 0;
+}
+
+
+void tw_timer_stop_workers(s_timer_t *T) {
+    int i;
+    if (T->workers == NULL)
+        return;
+    for (i = 0; i < T->nworkers; i++) {
+        __atomic_store_n(&T->workers[i].stop, 1, __ATOMIC_RELEASE);
+        sem_post(&T->workers[i].sem);
+    }
+    for (i = 0; i < T->nworkers; i++) {
+        pthread_join(T->workers[i].tid, NULL);
+        sem_destroy(&T->workers[i].sem);
+        free(T->workers[i].ring);
+    }
+    free(T->workers);
+    T->workers = NULL;
+    T->nworkers = 0;
+}
+
+
+int tw_timer_worker_stats(s_timer_t *T, int idx, timer_worker_stats_t *st) {
+    timer_worker_t *w;
+    if (idx < 0 || idx >= T->nworkers)
+        return -1;
+    w = &T->workers[idx];
+    st->dispatched = __atomic_load_n(&w->stats.dispatched, __ATOMIC_RELAXED);
+    st->executed = __atomic_load_n(&w->stats.executed, __ATOMIC_RELAXED);
+    st->queue_full = __atomic_load_n(&w->stats.queue_full, __ATOMIC_RELAXED);
+    st->depth = __atomic_load_n(&w->tail, __ATOMIC_RELAXED) - __atomic_load_n(&w->head, __ATOMIC_RELAXED);
+    st->depth_max = __atomic_load_n(&w->stats.depth_max, __ATOMIC_RELAXED);
+    st->lag_total_us = __atomic_load_n(&w->stats.lag_total_us, __ATOMIC_RELAXED);
+    st->lag_max_us = __atomic_load_n(&w->stats.lag_max_us, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+void timer_execute(s_timer_t *T) {  //  执行最小精度时间轮near的一个任务链表
+    int idx = T->time & TIME_NEAR_MASK;
+
+    while (!link_empty(&T->near[idx])) {
+        timer_node_t *current = link_clear(&T->near[idx]);
+        timer_node_t *node;
+        T->near_bits[idx >> 6] &= ~(1ull << (idx & 63));
+        for (node = current; node; node = node->next) // 释放锁之前标记，del_timer 不再从链表摘除
+            node->state = TIMER_NODE_FIRING;
+        timer_unlock(T);
+        dispath_list(T, current);
+        timer_lock(T);
+    }
+}
+
+
+static int bitmap_next(const uint64_t *bits, int nwords, int start) { // 从 start 开始第一个置位的下标，没有则返回 -1
+    int w = start >> 6;
+    uint64_t m;
+    if (w >= nwords)
+        return -1;
+    m = bits[w] & (~0ull << (start & 63));
+    while (m == 0) {
+        if (++w == nwords)
+            return -1;
+        m = bits[w];
+    }
+    return w * 64 + __builtin_ctzll(m);
+}
+
+
+/*
+ * 距离下一次需要处理的 tick 还有多少个 tick，没有任何节点时返回 UINT64_MAX
+ *   near 中的节点都在当前 256 区间内，只需找当前下标之后的第一个非空槽
+ *   t[i] 的第 j 个槽只在低 8+6i 位全为 0、第 i 层下标等于 j 的 tick 重新映射，
+ *   且 t[i] 中的节点都在当前 2^(14+6i) 区间内，层级越低事件越早
+ *   t[3] 中下标不大于当前下标的槽是超时时间回绕过 2^32 的节点，先推进到回绕点
+ */
+static uint64_t next_event(s_timer_t *T) {
+    uint32_t ct = T->time;
+    int i, j, shift;
+
+    j = bitmap_next(T->near_bits, TIME_NEAR / 64, (ct & TIME_NEAR_MASK) + 1);
+    if (j >= 0)
+        return (uint64_t)(j - (ct & TIME_NEAR_MASK));
+    for (i = 0; i < 4; i++) {
+        shift = TIME_NEAR_SHIFT + i * TIME_LEVEL_SHIFT;
+        j = bitmap_next(&T->level_bits[i], 1, ((ct >> shift) & TIME_LEVEL_MASK) + 1);
+        if (j >= 0) {
+            uint64_t base = (uint64_t)ct >> (shift + TIME_LEVEL_SHIFT) << (shift + TIME_LEVEL_SHIFT);
+            return base + ((uint64_t)j << shift) - ct;
+        }
+    }
+    if (T->level_bits[3])
+        return (1ull << 32) - ct;
+    return UINT64_MAX;
+}
+
+
+/*
+ * 执行高精度时间轮的当前槽
+ *   未到期的节点（放入时领先超过一圈）在释放锁之前放回原槽，之后只有回调新放入的已到期节点才再执行一轮
+ */
+static void hres_execute(s_timer_t *T) {
+    uint32_t ct = (uint32_t)T->hres_time;
+    int idx = ct & TIME_HRES_MASK;
+
+    while (!link_empty(&T->hres[idx])) {
+        timer_node_t *current = link_clear(&T->hres[idx]);
+        timer_node_t *due = NULL, **tail = &due;
+        T->hres_bits[idx >> 6] &= ~(1ull << (idx & 63));
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            if ((int32_t)(temp->expire - ct) > 0) {
+                link(&T->hres[idx], temp);
+                T->hres_bits[idx >> 6] |= 1ull << (idx & 63);
+                continue;
+            }
+            temp->state = TIMER_NODE_FIRING; // 释放锁之前标记，del_timer 不再从链表摘除
+            *tail = temp;
+            tail = &temp->next;
+        }
+        *tail = NULL;
+        if (due == NULL)
+            break;
+        timer_unlock(T);
+        dispath_list(T, due);
+        timer_lock(T);
+    }
+}
+
+
+static uint64_t hres_next_event(s_timer_t *T) {  // 距离下一个非空槽的 tick 数（1 ~ TIME_HRES），当前槽排在最后；没有节点时返回 UINT64_MAX
+    int s = ((uint32_t)T->hres_time + 1) & TIME_HRES_MASK;
+    int j = bitmap_next(T->hres_bits, TIME_HRES / 64, s);
+    if (j < 0)
+        j = bitmap_next(T->hres_bits, TIME_HRES / 64, 0);
+    if (j < 0)
+        return UINT64_MAX;
+    return (uint64_t)((j - s) & TIME_HRES_MASK) + 1;
+}
+
+
+static void hres_advance(s_timer_t *T, uint64_t now) {  // 持有锁时调用，推进到高精度 tick now，只在非空槽上停下
+    uint64_t d;
+    for (;;) {
+        hres_execute(T);
+        if (T->hres_time >= now)
+            break;
+        d = hres_next_event(T);
+        if (d > now - T->hres_time)
+            d = now - T->hres_time;
+        T->hres_time += d;
+    }
+}
+
+
+/*
+ * TIMER_NO_CASCADE：执行当前 tick 到期的节点
+ *   all 为 0 时只执行第 0 层的当前槽（本 tick 的高层槽已经执行过，只可能有新放入的已过期节点）
+ *   高层当前槽中的节点先移到第 0 层的当前槽，与其一起执行；未到期的（超出范围的长定时器）重新放入
+ */
+static void lvl_execute(s_timer_t *T, int all) {
+    uint32_t ct = T->time;
+    int lvl, idx = ct & (TIME_LVL_SIZE - 1);
+    link_list_t *now = &T->wheel[0][idx];
+
+    for (lvl = 1; all && lvl < TIME_LVL_DEPTH && (ct & (LVL_GRAN(lvl) - 1)) == 0; lvl++) {
+        int i = (ct >> LVL_SHIFT(lvl)) & (TIME_LVL_SIZE - 1);
+        timer_node_t *current = link_clear(&T->wheel[lvl][i]);
+        T->wheel_bits[lvl] &= ~(1ull << i);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            if ((int32_t)(temp->expire - ct) > 0) {
+                lvl_add_node(T, temp);
+                T->stats.cascaded++;
+                continue;
+            }
+            temp->level = 0;
+            link(now, temp);
+            T->wheel_bits[0] |= 1ull << idx;
+        }
+    }
+
+    while (!link_empty(now)) {
+        timer_node_t *current = link_clear(now);
+        timer_node_t *node;
+        T->wheel_bits[0] &= ~(1ull << idx);
+        for (node = current; node; node = node->next) // 释放锁之前标记，del_timer 不再从链表摘除
+            node->state = TIMER_NODE_FIRING;
+        timer_unlock(T);
+        dispath_list(T, current);
+        timer_lock(T);
+    }
+}
+
+
+static uint64_t lvl_next_event(s_timer_t *T) {  // 距离下一个要执行的非空槽还有多少个 tick，没有节点时返回 UINT64_MAX
+    uint32_t ct = T->time;
+    uint64_t best = UINT64_MAX, d, bits, c;
+    int lvl, s;
+
+    for (lvl = 0; lvl < TIME_LVL_DEPTH; lvl++) {
+        if ((bits = T->wheel_bits[lvl]) == 0)
+            continue;
+        // 第 lvl 层的第 j 个槽在 tick >> LVL_SHIFT(lvl) 的低 6 位为 j 且低位全为 0 时执行，
+        // 从当前位置的下一个槽开始循环查找，当前槽本身排在最后（下一圈）
+        c = ct >> LVL_SHIFT(lvl);
+        s = (int)((c + 1) & (TIME_LVL_SIZE - 1));
+        if (s)
+            bits = (bits >> s) | (bits << (64 - s));
+        d = ((c + 1 + __builtin_ctzll(bits)) << LVL_SHIFT(lvl)) - ct;
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+
+static void lvl_advance(s_timer_t *T, uint64_t n) {  // 与 timer_advance 相同，只在有非空槽的 tick 上停下
+    uint64_t d;
+    int all = 0;
+    timer_lock(T);
+    for (;;) {
+        drain_pending(T);
+        lvl_execute(T, all);
+        if (n == 0)
+            break;
+        d = lvl_next_event(T);
+        if (d > n)          // 剩余的 tick 内没有任何事件，终点上也没有
+            d = n;
+        __atomic_store_n(&T->time, T->time + (uint32_t)d, __ATOMIC_RELAXED);
+        n -= d;
+        all = 1;
+    }
+    timer_unlock(T);
+}
+
+
+/*
+ * 推进 n 个 tick，效果与逐个 tick 推进相同（执行当前槽、推进一格并重新映射、再执行当前槽）
+ * 中间没有非空槽位需要执行或重新映射的 tick 直接跳过，
+ * 耗时与经过的非空槽位数成正比，而不是与 n 成正比
+ */
+void timer_advance(s_timer_t *T, uint64_t n) {
+    uint64_t d;
+    if (T->wheel) {
+        lvl_advance(T, n);
+        return;
+    }
+    timer_lock(T);
+    for (;;) {
+        drain_pending(T);   // 先放入各线程新提交的节点
+        timer_execute(T);   // 执行当前槽中所有节点
+        if (n == 0)
+            break;
+        d = next_event(T);
+        if (d > n) {        // 剩余的 tick 内没有任何事件，直接跳到终点
+            __atomic_store_n(&T->time, T->time + (uint32_t)n, __ATOMIC_RELAXED);
+            n = 0;
+            continue;
+        }
+        // 跳到事件的前一个 tick，再由 timer_shift 推进一格并重新映射
+        __atomic_store_n(&T->time, T->time + (uint32_t)(d - 1), __ATOMIC_RELAXED);
+        timer_shift(T);
+        n -= d;             // 下一轮先执行推进后落入当前槽的节点
+    }
+    timer_unlock(T);
+}
+
+
+static unsigned pending_cascades(timer_node_t *node) { // 节点到期前还要被 move_list 重新映射的次数
+    unsigned n = 0;
+    int i;
+    if (node->level == 0 || node->level == TIMER_LEVEL_HRES)
+        return 0;
+    // t[i] 中的节点映射到下一个非零的 6 位所在的层级，全为零时直接进入 near
+    for (i = 0; i < node->level - 1; i++) {
+        if ((node->expire >> (TIME_NEAR_SHIFT + i * TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)
+            n++;
+    }
+    return n + 1;
+}
+
+
+void tw_timer_del(s_timer_t *T, timer_node_t *node) { // 删除一个任务节点，这个任务会被删除而不执行；周期任务同样用它取消
+    timer_lock(T);
+    if (node->state == TIMER_NODE_LINKED) {
+        unlink_node(T, node);
+        T->stats.removed++;
+        T->stats.removed_bytes += sizeof(timer_node_t);
+        if (!T->wheel)
+            T->stats.cascade_avoided += pending_cascades(node);
+        timer_unlock(T);
+        timer_pool_free(node_pool, node);
+        return;
+    }
+    node->cancel = 1;
+    timer_unlock(T);
+}
+
+
+void tw_timer_del_batch(s_timer_t *T, timer_node_t **nodes, int n) { // 只加一次锁，摘除的节点在释放锁之后再归还
+    timer_node_t *freed = NULL, *node;
+    int i;
+
+    timer_lock(T);
+    for (i = 0; i < n; i++) {
+        node = nodes[i];
+        if (node == NULL)
+            continue;
+        if (node->state == TIMER_NODE_LINKED) {
+            unlink_node(T, node);
+            T->stats.removed++;
+            T->stats.removed_bytes += sizeof(timer_node_t);
+            if (!T->wheel)
+                T->stats.cascade_avoided += pending_cascades(node);
+            node->next = freed;
+            freed = node;
+        } else {
+            node->cancel = 1;
+        }
+    }
+    timer_unlock(T);
+
+    while (freed) {
+        node = freed;
+        freed = node->next;
+        timer_pool_free(node_pool, node);
+    }
+}
+
+
+void tw_timer_stats(s_timer_t *T, timer_stats_t *st) {
+    timer_lock(T);
+    *st = T->stats;
+    timer_unlock(T);
+}
+
+
+#ifdef SPINLOCK_STATS
+void tw_timer_lock_stats(s_timer_t *T, spinlock_stats_t *st) {
+    spinlock_stats(&T->lock, st);
+}
+#endif
+
+
+s_timer_t* tw_timer_create(int flags) {
+    
+#ifdef TIMER_USE_POOL
+    if (!mem_pool_create_once(&node_pool, sizeof(timer_node_t), TIMER_POOL_SLAB, TIMER_POOL_FLAGS))
+        return NULL;
+#endif
+    s_timer_t *r = (s_timer_t *)malloc(sizeof(s_timer_t));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->flags = flags;
+    
+    int i, j;
+    for (i = 0; i < TIME_NEAR; i++) {
+        link_init(&r->near[i]);
+    }
+    for (i = 0; i < 4; i++) {
+        for(j = 0; j < TIME_LEVEL; j++) {
+            link_init(&r->t[i][j]);
+        }
+    }
+    if (flags & TIMER_NO_CASCADE) {
+        r->wheel = (link_list_t (*)[TIME_LVL_SIZE])malloc(TIME_LVL_DEPTH * sizeof(*r->wheel));
+        if (r->wheel == NULL) {
+            free(r);
+            return NULL;
+        }
+        for (i = 0; i < TIME_LVL_DEPTH; i++)
+            for (j = 0; j < TIME_LVL_SIZE; j++)
+                link_init(&r->wheel[i][j]);
+    }
+    spinlock_init(&r->lock);
+    mpsc_init(&r->pending);
+    r->current = 0;
+    r->current_point = gettime();
+    r->origin = r->current_point;
+
+    return r;
+}
+
+
+uint64_t gettime() {  // 获取系统时间
+    uint64_t t;
+#if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	t = (uint64_t)ti.tv_sec * 1000;
+	t += ti.tv_nsec / 1000000;
+	// 1ns = 1/1000000000 s = 1/1000000 ms
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	t = (uint64_t)tv.tv_sec * 100;
+	t += tv.tv_usec / 10000;
+#endif
+
+    return t;
+}
+
+
+static uint64_t gettime_ns() {  // 高精度时间轮使用，与 gettime 同一个时钟
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return (uint64_t)ti.tv_sec * 1000000000 + ti.tv_nsec;
+}
+
+
+static int64_t hres_nearest_ns(s_timer_t *T, uint64_t now) {  // 持有锁时调用，距离高精度时间轮下一个非空槽的纳秒数，没有节点时返回 -1
+    uint64_t d;
+    int64_t diff;
+    if (T->hres == NULL)
+        return -1;
+    if (!link_empty(&T->hres[(uint32_t)T->hres_time & TIME_HRES_MASK]))
+        return 0;  // 已过期的节点刚放入当前槽
+    d = hres_next_event(T);
+    if (d == UINT64_MAX)
+        return -1;
+    diff = (int64_t)((T->hres_time + d) * TIME_HRES_NS - now);
+    return diff < 0 ? 0 : diff;
+}
+
+
+int tw_timer_nearest(s_timer_t *T) {
+    uint64_t d, now;
+    int64_t diff, hres;
+
+    timer_lock(T);
+    drain_pending(T);  // 提交队列中的节点也要算上
+    hres = hres_nearest_ns(T, gettime_ns());
+    if (T->wheel)
+        d = link_empty(&T->wheel[0][T->time & (TIME_LVL_SIZE - 1)]) ? lvl_next_event(T) : 1;
+    else if (!link_empty(&T->near[T->time & TIME_NEAR_MASK]))
+        d = 1;          // 已过期的节点刚放入当前槽，下一次推进时执行
+    else
+        d = next_event(T);
+    timer_unlock(T);
+    if (hres >= 0)  // 高精度时间轮中的节点向上取整到毫秒，不会因为提前醒来而空转
+        hres = (hres + 999999) / 1000000;
+    if (d == UINT64_MAX)
+        return (int)hres;
+
+    // 内部时间 T->time 对应的系统时间是 current_point
+    now = gettime();
+    diff = (int64_t)(T->current_point + d - now);
+    if (diff < 0)
+        diff = 0;
+    if (hres >= 0 && hres < diff)
+        diff = hres;
+    return diff > INT32_MAX ? INT32_MAX : (int)diff;
+}
+
+
+int tw_timer_nearest_us(s_timer_t *T) {
+    uint64_t d, now;
+    int64_t diff, hres;
+
+    timer_lock(T);
+    drain_pending(T);
+    now = gettime_ns();
+    hres = hres_nearest_ns(T, now);
+    if (T->wheel)
+        d = link_empty(&T->wheel[0][T->time & (TIME_LVL_SIZE - 1)]) ? lvl_next_event(T) : 1;
+    else if (!link_empty(&T->near[T->time & TIME_NEAR_MASK]))
+        d = 1;
+    else
+        d = next_event(T);
+    timer_unlock(T);
+    if (hres >= 0)
+        hres = (hres + 999) / 1000;
+    if (d == UINT64_MAX)
+        return (int)hres;
+
+    diff = (int64_t)((T->current_point + d) * 1000000 - now);  // 毫秒时间轮的节点在对应毫秒开始时到期
+    if (diff < 0)
+        diff = 0;
+    diff = (diff + 999) / 1000;
+    if (hres >= 0 && hres < diff)
+        diff = hres;
+    return diff > INT32_MAX ? INT32_MAX : (int)diff;
+}
+
+
+void tw_timer_expire(s_timer_t *T) {   // 以系统时间为参照，推动定时器
+    uint64_t cp, ns;
+    if (T->hres) {  // 先推进高精度时间轮，毫秒时间轮使用同一次读到的时间
+        ns = gettime_ns();
+        timer_lock(T);
+        drain_pending(T);
+        hres_advance(T, ns / TIME_HRES_NS);
+        timer_unlock(T);
+        cp = ns / 1000000;
+    } else {
+        cp = gettime();
+    }
+    if (cp != T->current_point) {
+        uint32_t diff = (uint32_t)(cp - T->current_point); // 距离上一次更新的时长
+        T->current_point = cp;
+        timer_advance(T, diff); // 补偿时差，只在有节点的 tick 上停下
+    }
+}
+
+
+#ifdef TIMER_USE_POOL
+void get_pool_stats(mem_pool_stats_t *st) {
+	mem_pool_stats(node_pool, st);
+}
+#endif
+
+
+static void timer_clear(s_timer_t *T) {   // 释放所有节点
+    int i, j;
+    timer_lock(T);
+    drain_pending(T);  // 还在提交队列中的节点一并释放
+    for (i = 0; i < TIME_NEAR; i++) {  // 遍历释放near所有的链表的节点空间
+        timer_node_t *current = link_clear(&T->near[i]);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    for (i = 0; i < 4; i++) {   // 遍历释放二维指针数组t的所有链表空间
+        for (j = 0; j < TIME_LEVEL; j++) {
+            timer_node_t *current = link_clear(&T->t[i][j]);
+            while (current) {
+                timer_node_t *temp = current;
+                current = current->next;
+                timer_pool_free(node_pool, temp);
+            }
+        }
+    }
+    for (i = 0; T->wheel && i < TIME_LVL_DEPTH; i++) {
+        for (j = 0; j < TIME_LVL_SIZE; j++) {
+            timer_node_t *current = link_clear(&T->wheel[i][j]);
+            while (current) {
+                timer_node_t *temp = current;
+                current = current->next;
+                timer_pool_free(node_pool, temp);
+            }
+        }
+    }
+    memset(T->near_bits, 0, sizeof(T->near_bits));
+    memset(T->level_bits, 0, sizeof(T->level_bits));
+    for (i = 0; T->hres && i < TIME_HRES; i++) {
+        timer_node_t *current = link_clear(&T->hres[i]);
+        while (current) {
+            timer_node_t *temp = current;
+            current = current->next;
+            timer_pool_free(node_pool, temp);
+        }
+    }
+    memset(T->wheel_bits, 0, sizeof(T->wheel_bits));
+    memset(T->hres_bits, 0, sizeof(T->hres_bits));
+    timer_unlock(T);
+}
+
+
+void tw_timer_destroy(s_timer_t *T) {   // 销毁实例以及其中所有节点
+    tw_timer_stop_workers(T);  // 先执行完已交给工作线程的节点
+    timer_clear(T);
+    free(T->wheel);
+    free(T->hres);
+    free(T);
+}
+
+
+tw_sharded_t* tw_sharded_create(int nshards, int flags) {
+    int i;
+    if (nshards <= 0 || nshards > UINT16_MAX + 1)
+        return NULL;
+    tw_sharded_t *S = (tw_sharded_t *)malloc(sizeof(tw_sharded_t));
+    if (S == NULL)
+        return NULL;
+    S->shards = (s_timer_t **)calloc(nshards, sizeof(s_timer_t *));
+    if (S->shards == NULL) {
+        free(S);
+        return NULL;
+    }
+    S->nshards = nshards;
+    for (i = 0; i < nshards; i++) {
+        S->shards[i] = tw_timer_create(flags);
+        if (S->shards[i] == NULL) {
+            tw_sharded_destroy(S);
+            return NULL;
+        }
+        S->shards[i]->shard = (uint16_t)i;
+        if (i > 0)  // 所有分片使用同一个时间原点，节点的 expire 可以直接比较
+            S->shards[i]->current_point = S->shards[i]->origin = S->shards[0]->origin;
+    }
+    return S;
+}
+
+
+void tw_sharded_destroy(tw_sharded_t *S) {
+    int i;
+    for (i = 0; i < S->nshards; i++)
+        if (S->shards[i])
+            tw_timer_destroy(S->shards[i]);
+    free(S->shards);
+    free(S);
+}
+
+
+int tw_sharded_count(tw_sharded_t *S) {
+    return S->nshards;
+}
+
+
+s_timer_t* tw_sharded_shard(tw_sharded_t *S, int idx) {
+    return idx >= 0 && idx < S->nshards ? S->shards[idx] : NULL;
+}
+
+
+static s_timer_t* shard_of(tw_sharded_t *S, int threadid) {  // threadid 为负数时按当前 CPU 选择分片
+    int idx = threadid;
+    if (idx < 0) {
+#ifdef __linux__
+        idx = sched_getcpu();
+        if (idx < 0)
+            idx = 0;
+#else
+        idx = 0;
+#endif
+    }
+    return S->shards[(unsigned)idx % (unsigned)S->nshards];
+}
+
+
+timer_node_t* tw_sharded_add(tw_sharded_t *S, int time, handler_pt func, int threadid) {
+    return tw_timer_add(shard_of(S, threadid), time, func, threadid);
+}
+
+
+timer_node_t* tw_sharded_add_periodic(tw_sharded_t *S, int interval, handler_pt func, int threadid, int mode) {
+    return tw_timer_add_periodic(shard_of(S, threadid), interval, func, threadid, mode);
+}
+
+
+void tw_sharded_del(tw_sharded_t *S, timer_node_t *node) {  // 节点记录了所在分片，可以在任意线程删除
+    tw_timer_del(S->shards[node->shard], node);
+}
+
+
+int tw_sharded_add_batch(tw_sharded_t *S, const timer_req_t *reqs, int n, timer_node_t **out) {
+    return add_batch(S->shards[0], S, reqs, n, out);
+}
+
+
+void tw_sharded_del_batch(tw_sharded_t *S, timer_node_t **nodes, int n) {  // 连续属于同一分片的节点一起删除，只加一次该分片的锁
+    int i = 0, j;
+    while (i < n) {
+        if (nodes[i] == NULL) {
+            i++;
+            continue;
+        }
+        for (j = i + 1; j < n && (nodes[j] == NULL || nodes[j]->shard == nodes[i]->shard); j++) {}
+        tw_timer_del_batch(S->shards[nodes[i]->shard], nodes + i, j - i);
+        i = j;
+    }
+}
+
+
+int tw_sharded_start_workers(tw_sharded_t *S, int nworkers, unsigned queue_cap) {  // 每个分片各自启动 nworkers 个
+    int i;
+    for (i = 0; i < S->nshards; i++) {
+        if (tw_timer_start_workers(S->shards[i], nworkers, queue_cap) != 0) {
+            while (i-- > 0)
+                tw_timer_stop_workers(S->shards[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void tw_sharded_stop_workers(tw_sharded_t *S) {
+    int i;
+    for (i = 0; i < S->nshards; i++)
+        tw_timer_stop_workers(S->shards[i]);
+}
+
+
+void tw_sharded_expire(tw_sharded_t *S) {  // 由一个线程统一推进所有分片
+    int i;
+    for (i = 0; i < S->nshards; i++)
+        tw_timer_expire(S->shards[i]);
+}
+
+
+int tw_sharded_nearest(tw_sharded_t *S) {
+    int i, d, ret = -1;
+    for (i = 0; i < S->nshards; i++) {
+        d = tw_timer_nearest(S->shards[i]);
+        if (d >= 0 && (ret < 0 || d < ret))
+            ret = d;
+    }
+    return ret;
+}
+
+
+void tw_sharded_stats(tw_sharded_t *S, timer_stats_t *st) {
+    timer_stats_t one;
+    int i;
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < S->nshards; i++) {
+        tw_timer_stats(S->shards[i], &one);
+        st->removed += one.removed;
+        st->removed_bytes += one.removed_bytes;
+        st->cascaded += one.cascaded;
+        st->cascade_avoided += one.cascade_avoided;
+    }
+}
+
+
+/* 全局接口，操作默认实例 TI，init_timer_sharded 之后操作分片时间轮 TS */
+
+void 
+init_timer(void) {
+	TI = tw_timer_create(0);
+}
+
+
+int init_timer_sharded(int nshards) {
+    TS = tw_sharded_create(nshards, 0);
+    if (TS == NULL)
+        return -1;
+    TI = TS->shards[0];
+    return 0;
+}
+
+
+timer_node_t * add_timer(int time, handler_pt func, int threadid) {
+    if (TS)
+        return tw_sharded_add(TS, time, func, threadid);
+    return tw_timer_add(TI, time, func, threadid);
+}
+
+
+timer_node_t * add_periodic_timer(int interval, handler_pt func, int threadid, int mode) {
+    if (TS)
+        return tw_sharded_add_periodic(TS, interval, func, threadid, mode);
+    return tw_timer_add_periodic(TI, interval, func, threadid, mode);
+}
+
+
+void del_timer(timer_node_t *node) {
+    if (TS)
+        tw_sharded_del(TS, node);
+    else
+        tw_timer_del(TI, node);
+}
+
+
+void get_timer_stats(timer_stats_t *st) {
+    if (TS)
+        tw_sharded_stats(TS, st);
+    else
+        tw_timer_stats(TI, st);
+}
+
+
+int find_nearest_expire_timer(void) {
+    if (TS)
+        return tw_sharded_nearest(TS);
+    return tw_timer_nearest(TI);
+}
+
+
+int set_timer_hires(int threshold_us) {
+    int i;
+    if (TS == NULL)
+        return tw_timer_set_hires(TI, threshold_us);
+    for (i = 0; i < TS->nshards; i++)
+        if (tw_timer_set_hires(TS->shards[i], threshold_us) != 0)
+            return -1;
+    return 0;
+}
+
+
+timer_node_t * add_timer_us(int time_us, handler_pt func, int threadid) {
+    return tw_timer_add_us(TS ? shard_of(TS, threadid) : TI, time_us, func, threadid);
+}
+
+
+int find_nearest_expire_timer_us(void) {
+    int i, d, ret;
+    if (TS == NULL)
+        return tw_timer_nearest_us(TI);
+    for (i = 0, ret = -1; i < TS->nshards; i++) {
+        d = tw_timer_nearest_us(TS->shards[i]);
+        if (d >= 0 && (ret < 0 || d < ret))
+            ret = d;
+    }
+    return ret;
+}
+
+
+void expire_timer(void) {
+    if (TS)
+        tw_sharded_expire(TS);
+    else
+        tw_timer_expire(TI);
+}
+
+
+void clear_timer() {   // 释放默认实例中的所有节点
+    int i;
+    if (TS) {
+        for (i = 0; i < TS->nshards; i++)
+            timer_clear(TS->shards[i]);
+        return;
+    }
+    timer_clear(TI);
+}
+
+
+int start_timer_workers(int nworkers, unsigned queue_cap) {
+    if (TS)
+        return tw_sharded_start_workers(TS, nworkers, queue_cap);
+    return tw_timer_start_workers(TI, nworkers, queue_cap);
+}
+
+
+void stop_timer_workers(void) {
+    if (TS)
+        tw_sharded_stop_workers(TS);
+    else
+        tw_timer_stop_workers(TI);
+}
+
+
+int add_timers_batch(const timer_req_t *reqs, int n, timer_node_t **out) {
+    if (TS)
+        return tw_sharded_add_batch(TS, reqs, n, out);
+    return tw_timer_add_batch(TI, reqs, n, out);
+}
+
+
+void del_timers_batch(timer_node_t **nodes, int n) {
+    if (TS)
+        tw_sharded_del_batch(TS, nodes, n);
+    else
+        tw_timer_del_batch(TI, nodes, n);
+}
@@ -1,34 +1,215 @@
-#ifndef _MARK_TIMEWHEEL_
-#define _MARK_TIMEWHEEL_
-
-#include <stdint.h>
-
-#define TIME_NEAR_SHIFT 8
-#define TIME_NEAR (1 << TIME_NEAR_SHIFT) // 将 1 左移动8位 结果是2的8次幂，256
-#define TIME_LEVEL_SHIFT 6
-#define TIME_LEVEL (1 << TIME_LEVEL_SHIFT) // 将 1 左移 6位
-#define TIME_NEAR_MASK (TIME_NEAR-1)
-#define TIME_LEVEL_MASK (TIME_LEVEL-1)
-
-typedef struct timer_node timer_node_t;
-typedef void (*handler_pt) (struct timer_node *node);
-
-struct timer_node {
-	struct timer_node *next;
-	uint32_t expire;
-    handler_pt callback;
-    uint8_t cancel;
-	int id; // 此时携带参数
-};
-
-timer_node_t* add_timer(int time, handler_pt func, int threadid);
-
-void expire_timer(void);
-
-void del_timer(timer_node_t* node);
-
-void init_timer(void);
-
-void clear_timer();
-
-#endif
+#ifndef _MARK_TIMEWHEEL_
+#define _MARK_TIMEWHEEL_
+
+#include <stdint.h>
+
+#define TIME_NEAR_SHIFT 8
+#define TIME_NEAR (1 << TIME_NEAR_SHIFT) // 将 1 左移动8位 结果是2的8次幂，256
+#define TIME_LEVEL_SHIFT 6
+#define TIME_LEVEL (1 << TIME_LEVEL_SHIFT) // 将 1 左移 6位
+#define TIME_NEAR_MASK (TIME_NEAR-1)
+#define TIME_LEVEL_MASK (TIME_LEVEL-1)
+
+// TIMER_NO_CASCADE 模式的分层时间轮：TIME_LVL_DEPTH 层，每层 64 个槽，每一层的粒度是上一层的 8 倍
+#define TIME_LVL_CLK_SHIFT 3
+#define TIME_LVL_SIZE 64
+#define TIME_LVL_DEPTH 9
+
+// 高精度时间轮（见 tw_timer_set_hires）：TIME_HRES 个槽，每个槽 TIME_HRES_NS 纳秒，覆盖约 10ms
+#define TIME_HRES_SHIFT 10
+#define TIME_HRES (1 << TIME_HRES_SHIFT)
+#define TIME_HRES_MASK (TIME_HRES-1)
+#define TIME_HRES_NS 10000
+
+#define TIMER_FIXED_RATE  0 // 固定频率：下次超时时间 = 本次超时时间 + 间隔，不会累积漂移
+#define TIMER_FIXED_DELAY 1 // 固定延迟：下次超时时间 = 回调返回时的时间 + 间隔
+
+typedef struct timer_node timer_node_t;
+typedef void (*handler_pt) (struct timer_node *node);
+
+struct timer_node {
+	struct timer_node *next;
+	struct timer_node *prev; // 槽位为双向循环链表，del_timer 可以直接摘除
+	uint32_t expire;
+    handler_pt callback;
+    uint8_t cancel;
+    uint8_t mode;      // 周期任务的重新调度方式
+    uint8_t state;     // 节点当前所处的位置，只在持有锁时读写
+    uint8_t level;     // 所在层级：0 为 near，1~4 为 t[0]~t[3]；TIMER_NO_CASCADE 时为 0~8；高精度时间轮中为 0xff
+    uint32_t interval; // 周期任务的间隔，0 表示一次性任务
+	int id; // 此时携带参数
+    uint16_t shard;    // 所在分片的下标，见 tw_sharded_t
+};
+
+typedef struct timer s_timer_t;
+
+typedef struct timer_stats_s {
+    uint64_t removed;          // del_timer 直接摘除并释放的节点数
+    uint64_t removed_bytes;    // 这些节点提前归还的内存
+    uint64_t cascaded;         // move_list 实际重新映射的节点数
+    uint64_t cascade_avoided;  // 被摘除的节点原本还要经历的重新映射次数
+} timer_stats_t;
+
+/*
+ * 实例接口：每个事件循环可以各自创建一个时间轮
+ *   flags 为 0：add / del 可以在任意线程调用，推进时间轮（expire）同一时刻只能有一个线程
+ *   TIMER_UNLOCKED：实例只在创建它的线程中使用，所有操作都不加锁，add 直接放入时间轮
+ */
+#define TIMER_UNLOCKED 0x1
+
+/*
+ * TIMER_NO_CASCADE：不做重新映射的分层时间轮（参照 Linux 4.8 之后的实现），节点只在放入和执行时被访问，
+ *   推进时不会因为整批搬移长定时器而出现几十毫秒的停顿
+ *   代价是精度随超时时间降低：第 n 层的粒度为 8^n 个 tick，超时时间向上取整到粒度的倍数，
+ *   不会提前执行，最多推迟约 1/8 的超时时间（如 1 小时的定时器最多晚约 4.4 分钟）
+ *   超时时间在 63 个 tick 以内的节点与默认模式一样精确
+ */
+#define TIMER_NO_CASCADE 0x2
+
+s_timer_t* tw_timer_create(int flags);
+void tw_timer_destroy(s_timer_t *T); // 释放实例以及其中所有节点
+
+// flags 为 0 时 add 本身也不加锁：节点先进入无锁提交队列，下一次 expire 推进时放入时间轮
+timer_node_t* tw_timer_add(s_timer_t *T, int time, handler_pt func, int threadid);
+
+// 周期任务：节点在每次回调后原地重新插入，直到 del
+timer_node_t* tw_timer_add_periodic(s_timer_t *T, int interval, handler_pt func, int threadid, int mode);
+
+// 已在时间轮中的节点立即摘除并释放；还在提交队列中或正在执行的节点只打标记，之后由时间轮释放
+void tw_timer_del(s_timer_t *T, timer_node_t *node);
+
+void tw_timer_expire(s_timer_t *T);
+
+void timer_advance(s_timer_t *T, uint64_t n); // 不读取系统时间，直接推进 n 个 tick，用于模拟和测试
+
+/*
+ * 距离下一个非空槽位或需要重新映射的槽位还有多少毫秒，时间轮为空时返回 -1
+ * 可以直接作为 epoll_wait 的超时时间，醒来后调用 expire；
+ * 遇到重新映射点时返回的时间早于实际超时时间，expire 之后再次查询即可
+ * 休眠期间其他线程新加的定时器不会唤醒调用方
+ */
+int tw_timer_nearest(s_timer_t *T);
+
+void tw_timer_stats(s_timer_t *T, timer_stats_t *st);
+
+/*
+ * 高精度时间轮：放在 near 之前的单层时间轮，由 CLOCK_MONOTONIC 纳秒驱动，粒度 TIME_HRES_NS（10 微秒）
+ *   tw_timer_add_us 的延迟小于 threshold_us 时放入高精度时间轮，否则向上取整到毫秒，照常放入毫秒时间轮
+ *   threshold_us 不能超过高精度时间轮的覆盖范围（约 10ms）；每个实例只能设置一次，
+ *   必须在该实例上调用 tw_timer_add_us 之前设置，不能与其他操作并发
+ * 精度取决于 tw_timer_expire 的调用频率：用 tw_timer_nearest_us 计算等待时间（epoll_pwait2、timerfd 或忙等）
+ * 成功返回 0
+ */
+int tw_timer_set_hires(s_timer_t *T, int threshold_us);
+
+timer_node_t* tw_timer_add_us(s_timer_t *T, int time_us, handler_pt func, int threadid); // 一次性任务，延迟单位为微秒
+
+int tw_timer_nearest_us(s_timer_t *T); // 同 tw_timer_nearest，单位为微秒，包括高精度时间轮中的节点
+
+/*
+ * 批量接口：节点一次性从对象池取出，提交队列只做一次原子交换，删除只加一次锁
+ *   out 必须能容纳 n 个指针，返回后 out[i] 对应 reqs[i]，立即执行的请求为 NULL
+ */
+typedef struct timer_req_s {
+    int time;            // 延迟，<= 0 时立即执行
+    handler_pt callback;
+    int id;              // 同 add 的 threadid
+} timer_req_t;
+
+int tw_timer_add_batch(s_timer_t *T, const timer_req_t *reqs, int n, timer_node_t **out); // 成功返回 0，节点不够时什么都不添加，返回 -1
+void tw_timer_del_batch(s_timer_t *T, timer_node_t **nodes, int n); // 跳过 NULL，语义同 del
+
+/*
+ * 工作线程派发：启动 nworkers 个工作线程，之后到期节点的回调在工作线程上执行，
+ *   推进线程只负责把节点放入队列，一个慢回调不再拖慢同一槽位的其他节点和下一次推进
+ *   node->id（add 时的 threadid）决定由哪个工作线程执行：id % nworkers，
+ *   同一个 id 的回调按到期顺序串行执行，不同 id 之间可能并发
+ *   每个工作线程一个容量为 queue_cap（向上取 2 的幂）的有界队列，队列满时推进线程等待
+ * 只能用于不带 TIMER_UNLOCKED 的实例，不能与 expire 并发调用；成功返回 0
+ */
+typedef struct timer_worker_stats_s {
+    uint64_t dispatched;    // 交给该工作线程的节点数
+    uint64_t executed;      // 已处理完的节点数
+    uint64_t queue_full;    // 入队时队列已满、推进线程需要等待的次数
+    uint32_t depth;         // 当前队列中的节点数
+    uint32_t depth_max;     // 入队后队列深度的最大值
+    uint64_t lag_total_us;  // 入队到开始执行的延迟之和（微秒），除以 executed 得到平均值
+    uint64_t lag_max_us;    // 入队到开始执行的最大延迟（微秒）
+} timer_worker_stats_t;
+
+int tw_timer_start_workers(s_timer_t *T, int nworkers, unsigned queue_cap);
+void tw_timer_stop_workers(s_timer_t *T); // 执行完队列中剩余的节点后退出所有工作线程
+int tw_timer_worker_stats(s_timer_t *T, int idx, timer_worker_stats_t *st); // idx 越界时返回 -1
+
+/*
+ * 分片时间轮：nshards 个独立的时间轮实例，add 按 threadid 选择分片（threadid % nshards），
+ *   threadid 为负数时按调用线程当前所在的 CPU（sched_getcpu）选择，
+ *   不同线程的 add / del 分散到不同分片的提交队列和锁上，不再争抢同一个 cache line
+ * 节点记录所在分片，del 可以在任意线程调用
+ * 批量添加按每个请求的 id 选择分片；批量删除按节点所在分片分组，每组只加一次该分片的锁
+ * 工作线程按分片启动：每个分片各自 nworkers 个，同一个 id 总是落在同一分片的同一个工作线程上
+ * 推进方式二选一：一个线程调用 tw_sharded_expire 统一推进，
+ *   或者每个分片由自己的线程对 tw_sharded_shard(S, i) 调用 tw_timer_expire
+ */
+typedef struct tw_sharded tw_sharded_t;
+
+tw_sharded_t* tw_sharded_create(int nshards, int flags); // flags 作用于每个分片，见 tw_timer_create
+void tw_sharded_destroy(tw_sharded_t *S);
+int tw_sharded_count(tw_sharded_t *S);
+s_timer_t* tw_sharded_shard(tw_sharded_t *S, int idx); // idx 越界时返回 NULL
+timer_node_t* tw_sharded_add(tw_sharded_t *S, int time, handler_pt func, int threadid);
+timer_node_t* tw_sharded_add_periodic(tw_sharded_t *S, int interval, handler_pt func, int threadid, int mode);
+void tw_sharded_del(tw_sharded_t *S, timer_node_t *node);
+void tw_sharded_expire(tw_sharded_t *S);
+int tw_sharded_nearest(tw_sharded_t *S); // 所有分片中最近的一个
+void tw_sharded_stats(tw_sharded_t *S, timer_stats_t *st); // 所有分片之和
+int tw_sharded_add_batch(tw_sharded_t *S, const timer_req_t *reqs, int n, timer_node_t **out); // 节点不够时什么都不添加，返回 -1
+void tw_sharded_del_batch(tw_sharded_t *S, timer_node_t **nodes, int n);
+int tw_sharded_start_workers(tw_sharded_t *S, int nworkers, unsigned queue_cap); // 任一分片失败时全部撤销，返回 -1
+void tw_sharded_stop_workers(tw_sharded_t *S);
+
+/* 以下全局接口操作 init_timer 创建的默认实例，或者 init_timer_sharded 创建的分片时间轮 */
+
+timer_node_t* add_timer(int time, handler_pt func, int threadid);
+
+timer_node_t* add_periodic_timer(int interval, handler_pt func, int threadid, int mode);
+
+void expire_timer(void);
+
+int find_nearest_expire_timer(void);
+
+int set_timer_hires(int threshold_us); // 分片时间轮的每个分片都设置
+
+timer_node_t* add_timer_us(int time_us, handler_pt func, int threadid);
+
+int find_nearest_expire_timer_us(void);
+
+void del_timer(timer_node_t* node);
+
+void get_timer_stats(timer_stats_t *st);
+
+void init_timer(void);
+
+int init_timer_sharded(int nshards); // 代替 init_timer，之后全局接口按 threadid 放入各分片；成功返回 0
+
+void clear_timer();
+
+int start_timer_workers(int nworkers, unsigned queue_cap); // 分片时间轮的每个分片各自启动 nworkers 个
+
+void stop_timer_workers(void);
+
+int add_timers_batch(const timer_req_t *reqs, int n, timer_node_t **out); // 分片时间轮按 reqs[i].id 选择分片
+
+void del_timers_batch(timer_node_t **nodes, int n); // 分片时间轮按节点所在分片删除
+
+#ifdef TIMER_USE_POOL
+#include "mempool.h"
+void get_pool_stats(mem_pool_stats_t *st); // 节点对象池的占用情况
+#endif
+
+#ifdef SPINLOCK_STATS
+#include "spinlock.h"
+void tw_timer_lock_stats(s_timer_t *T, spinlock_stats_t *st); // T->lock 的竞争情况
+#endif
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef MARK_TIMEWHEEL_HPP
+#define MARK_TIMEWHEEL_HPP
+
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <functional>
+
+/*
+ * 编译期确定几何参数的时间轮，结构与 timewheel.c 相同（near 轮 + Levels 层逐级重新映射）
+ *   TickNs：一个 tick 的纳秒数，如 100000（100us）、1000000（1ms）、1000000000（1s）
+ *   NearBits：near 轮 2^NearBits 个槽；LevelBits：每层 2^LevelBits 个槽；Levels：层数
+ * 掩码和移位都是编译期常量，add 时逐层判断用 if constexpr 展开，没有循环和运行时的层数
+ * 内部时间为 64 位 tick，不会回绕；超过 NearBits + LevelBits * Levels 位范围的定时器放在最高层，
+ *   最高层每转一圈重新放入一次，直到进入范围
+ * 与 timewheel.c 一样用位图跳过空槽：Advance 的耗时与经过的非空槽数成正比
+ * 不加锁，只能在一个线程中使用
+ *
+ *   TimeWheel<100000, 10, 6, 4>     100us tick，near 约 0.1s，总范围约 2^34 tick（约 20 天）
+ *   TimeWheel<1000000, 8, 6, 4>     与 timewheel.c 相同
+ *   TimeWheel<1000000000, 6, 6, 3>  1s tick，会话过期之类的长定时器
+ */
+template <uint64_t TickNs, unsigned NearBits, unsigned LevelBits, unsigned Levels>
+class TimeWheel {
+    static_assert(TickNs > 0, "TickNs 必须大于 0");
+    static_assert(NearBits >= 6 && NearBits <= 16, "near 位图按 64 位一组，NearBits 取 6~16");
+    static_assert(LevelBits >= 1 && LevelBits <= 6, "每层的位图只用一个 uint64_t，LevelBits 取 1~6");
+    static_assert(Levels >= 1 && NearBits + LevelBits * Levels <= 63, "总位数不能超过 63");
+
+public:
+    struct Node;
+    using Callback = std::function<void(Node &node)>;
+
+    struct Node {
+        Node *next = nullptr;
+        Node *prev = nullptr;
+        uint64_t expire = 0;     // 绝对超时 tick
+        uint64_t interval = 0;   // 周期定时器的间隔（tick），0 表示一次性定时器
+        Callback func;
+        uint8_t level = 0;       // 0 为 near，1~Levels 为 levels_[0]~levels_[Levels-1]
+        bool linked = false;     // 在某个槽位中，DelTimer 可以直接摘除
+        bool cancel = false;     // 回调执行期间被 DelTimer 取消
+    };
+
+    static constexpr uint64_t kTickNs = TickNs;
+    static constexpr uint64_t kNear = uint64_t(1) << NearBits;
+    static constexpr uint64_t kNearMask = kNear - 1;
+    static constexpr uint64_t kLevel = uint64_t(1) << LevelBits;
+    static constexpr uint64_t kLevelMask = kLevel - 1;
+    static constexpr unsigned kRangeBits = NearBits + LevelBits * Levels;
+
+    template <class Rep, class Period>
+    static constexpr uint64_t ToTicks(std::chrono::duration<Rep, Period> d) {  // 向上取整，不会提前执行
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return ns <= 0 ? 0 : (uint64_t(ns) + TickNs - 1) / TickNs;
+    }
+
+    TimeWheel() : origin_(NowNs()) {
+        for (auto &l : near_)
+            Init(&l);
+        for (auto &level : levels_)
+            for (auto &l : level)
+                Init(&l);
+    }
+
+    ~TimeWheel() {
+        for (auto &l : near_)
+            FreeList(&l);
+        for (auto &level : levels_)
+            for (auto &l : level)
+                FreeList(&l);
+        while (free_) {
+            Node *n = free_;
+            free_ = n->next;
+            delete n;
+        }
+    }
+
+    TimeWheel(const TimeWheel &) = delete;
+    TimeWheel &operator=(const TimeWheel &) = delete;
+
+    // ticks 个 tick 之后执行；为 0 时在下一次 Advance / Update 中执行
+    Node *AddTimerTicks(uint64_t ticks, Callback func) {
+        Node *node = Alloc();
+        node->expire = time_ + ticks;
+        node->interval = 0;
+        node->func = std::move(func);
+        node->cancel = false;
+        AddNode(node);
+        return node;
+    }
+
+    template <class Rep, class Period>
+    Node *AddTimer(std::chrono::duration<Rep, Period> delay, Callback func) {
+        return AddTimerTicks(ToTicks(delay), std::move(func));
+    }
+
+    // 周期定时器：每次回调后原节点按固定频率重新放入，直到 DelTimer
+    template <class Rep, class Period>
+    Node *AddPeriodicTimer(std::chrono::duration<Rep, Period> interval, Callback func) {
+        uint64_t ticks = ToTicks(interval);
+        Node *node = AddTimerTicks(ticks ? ticks : 1, std::move(func));
+        node->interval = ticks ? ticks : 1;
+        return node;
+    }
+
+    void DelTimer(Node *node) {  // 在槽位中的节点立即摘除并回收；正在执行的只打标记
+        if (node->linked) {
+            Unlink(node);
+            Free(node);
+            return;
+        }
+        node->cancel = true;
+    }
+
+    // 推进 n 个 tick，执行期间到期的节点；没有事件的 tick 直接跳过
+    void Advance(uint64_t n) {
+        for (;;) {
+            Execute();
+            if (n == 0)
+                break;
+            uint64_t d = NextEvent();
+            if (d > n) {
+                time_ += n;
+                n = 0;
+                continue;
+            }
+            time_ += d - 1;
+            Shift();
+            n -= d;
+        }
+    }
+
+    void Update() {  // 按 steady_clock 推进到当前时间
+        uint64_t now = (NowNs() - origin_) / TickNs;
+        if (now > time_)
+            Advance(now - time_);
+    }
+
+    // 距离下一个非空槽或需要重新映射的槽还有多少个 tick，没有定时器时返回 -1
+    int64_t NearestTicks() const {
+        if (size_ == 0)
+            return -1;
+        if (!Empty(&near_[time_ & kNearMask]))
+            return 0;
+        uint64_t d = NextEvent();
+        return d == UINT64_MAX ? -1 : int64_t(d);
+    }
+
+    uint64_t Now() const { return time_; }
+    size_t Size() const { return size_; }
+
+private:
+    struct List {  // 双向循环链表，head 为哨兵
+        Node head;
+    };
+
+    static uint64_t NowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void Init(List *l) { l->head.next = l->head.prev = &l->head; }
+    static bool Empty(const List *l) { return l->head.next == &l->head; }
+
+    static void Link(List *l, Node *node) {
+        node->prev = l->head.prev;
+        node->next = &l->head;
+        l->head.prev->next = node;
+        l->head.prev = node;
+    }
+
+    static Node *Clear(List *l) {  // 取出整个链表，返回以 nullptr 结尾的单链表
+        Node *ret = nullptr;
+        if (!Empty(l)) {
+            ret = l->head.next;
+            l->head.prev->next = nullptr;
+        }
+        Init(l);
+        return ret;
+    }
+
+    void FreeList(List *l) {
+        Node *n = Clear(l);
+        while (n) {
+            Node *next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    Node *Alloc() {  // 回收的节点挂在 free_ 上复用
+        size_++;
+        if (free_) {
+            Node *n = free_;
+            free_ = n->next;
+            return n;
+        }
+        return new Node;
+    }
+
+    void Free(Node *node) {
+        size_--;
+        node->func = nullptr;
+        node->next = free_;
+        free_ = node;
+    }
+
+    // 已经过期的节点放到当前 near 槽，本次 Execute 执行
+    void AddNode(Node *node) {
+        if (node->expire < time_)
+            node->expire = time_;
+        node->linked = true;
+        if ((node->expire | kNearMask) == (time_ | kNearMask)) {
+            uint64_t idx = node->expire & kNearMask;
+            node->level = 0;
+            Link(&near_[idx], node);
+            near_bits_[idx >> 6] |= uint64_t(1) << (idx & 63);
+            return;
+        }
+        Place<0>(node);
+    }
+
+    // 第一个高位与当前时间相同的层级；都不同时放在最高层
+    template <unsigned I>
+    void Place(Node *node) {
+        if constexpr (I + 1 < Levels) {
+            constexpr uint64_t mask = (uint64_t(1) << (NearBits + (I + 1) * LevelBits)) - 1;
+            if ((node->expire | mask) != (time_ | mask)) {
+                Place<I + 1>(node);
+                return;
+            }
+        }
+        constexpr unsigned shift = NearBits + I * LevelBits;
+        uint64_t idx = (node->expire >> shift) & kLevelMask;
+        node->level = I + 1;
+        Link(&levels_[I][idx], node);
+        level_bits_[I] |= uint64_t(1) << idx;
+    }
+
+    void Unlink(Node *node) {  // 槽位中只剩这一个节点时，next 就是链表头，由它清除位图
+        if (node->next == node->prev) {
+            List *l = reinterpret_cast<List *>(node->next);
+            if (node->level == 0) {
+                uint64_t idx = l - near_.data();
+                near_bits_[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
+            } else {
+                uint64_t idx = l - levels_[node->level - 1].data();
+                level_bits_[node->level - 1] &= ~(uint64_t(1) << idx);
+            }
+        }
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->linked = false;
+    }
+
+    void MoveList(unsigned level, uint64_t idx) {
+        Node *n = Clear(&levels_[level][idx]);
+        level_bits_[level] &= ~(uint64_t(1) << idx);
+        while (n) {
+            Node *next = n->next;
+            AddNode(n);
+            n = next;
+        }
+    }
+
+    // 时间 + 1；低位全为 0 的层级中，第一个下标不为 0 的槽整体重新映射
+    void Shift() {
+        ++time_;
+        Cascade<0>();
+    }
+
+    template <unsigned I>
+    void Cascade() {
+        constexpr unsigned shift = NearBits + I * LevelBits;
+        if ((time_ & ((uint64_t(1) << shift) - 1)) != 0)
+            return;
+        uint64_t idx = (time_ >> shift) & kLevelMask;
+        if constexpr (I + 1 < Levels) {
+            if (idx == 0) {
+                Cascade<I + 1>();
+                return;
+            }
+        }
+        MoveList(I, idx);  // 最高层下标为 0 时也要重新映射：其中是超出范围的定时器
+    }
+
+    void Execute() {
+        uint64_t idx = time_ & kNearMask;
+        while (!Empty(&near_[idx])) {  // 回调中可能又放入当前槽
+            Node *n = Clear(&near_[idx]);
+            near_bits_[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
+            for (Node *p = n; p; p = p->next)
+                p->linked = false;
+            while (n) {
+                Node *node = n;
+                n = n->next;
+                if (!node->cancel)
+                    node->func(*node);
+                if (!node->cancel && node->interval) {
+                    node->expire += node->interval;
+                    AddNode(node);
+                } else {
+                    Free(node);
+                }
+            }
+        }
+    }
+
+    static int BitmapNext(const uint64_t *bits, unsigned nwords, uint64_t start) {  // 从 start 开始第一个置位的下标，没有则返回 -1
+        unsigned w = unsigned(start >> 6);
+        if (w >= nwords)
+            return -1;
+        uint64_t m = bits[w] & (~uint64_t(0) << (start & 63));
+        while (m == 0) {
+            if (++w == nwords)
+                return -1;
+            m = bits[w];
+        }
+        return int(w * 64 + __builtin_ctzll(m));
+    }
+
+    // 距离下一次需要处理的 tick，见 timewheel.c 的 next_event
+    uint64_t NextEvent() const {
+        int j = BitmapNext(near_bits_.data(), kNear / 64, (time_ & kNearMask) + 1);
+        if (j >= 0)
+            return uint64_t(j) - (time_ & kNearMask);
+        return NextLevelEvent<0>();
+    }
+
+    template <unsigned I>
+    uint64_t NextLevelEvent() const {
+        constexpr unsigned shift = NearBits + I * LevelBits;
+        constexpr unsigned up = shift + LevelBits;
+        int j = BitmapNext(&level_bits_[I], 1, ((time_ >> shift) & kLevelMask) + 1);
+        if (j >= 0)
+            return ((time_ >> up) << up) + (uint64_t(j) << shift) - time_;
+        if constexpr (I + 1 < Levels) {
+            return NextLevelEvent<I + 1>();
+        } else {
+            if (level_bits_[I])  // 最高层中不大于当前下标的槽，下一圈从 0 号槽开始处理
+                return (((time_ >> up) + 1) << up) - time_;
+            return UINT64_MAX;
+        }
+    }
+
+    std::array<List, kNear> near_;
+    std::array<std::array<List, kLevel>, Levels> levels_;
+    std::array<uint64_t, kNear / 64> near_bits_{};
+    std::array<uint64_t, Levels> level_bits_{};
+    uint64_t time_ = 0;
+    uint64_t origin_;
+    size_t size_ = 0;
+    Node *free_ = nullptr;
+};
+
+#endif // MARK_TIMEWHEEL_HPP
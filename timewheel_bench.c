@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "timewheel.h"
+
+/*
+ * 多线程同时添加 / 删除定时器，比较逐个调用与批量接口的单个定时器开销
+ *   nthreads 个线程各自添加 PER_THREAD 个定时器，每次 batch 个（batch 为 1 时用 tw_timer_add），
+ *   另有一个线程不停调用 tw_timer_expire 推进时间轮，和添加线程争抢提交队列与 T->lock
+ *   全部添加完成后由 tw_timer_nearest 放入时间轮，再由各线程按同样的批次大小删除
+ */
+#define PER_THREAD 256000
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void handler(timer_node_t *node) {
+    (void)node;
+}
+
+typedef struct bench_arg {
+    s_timer_t *T;
+    int batch;
+    uint32_t seed;
+    timer_node_t **nodes;
+    pthread_barrier_t *barrier;
+    uint64_t add_ns, del_ns;
+} bench_arg_t;
+
+static s_timer_t *ticking;
+static volatile int ticking_stop;
+
+static void * ticker(void *arg) {
+    (void)arg;
+    while (!ticking_stop)
+        tw_timer_expire(ticking);
+    return NULL;
+}
+
+static void * worker(void *p) {
+    bench_arg_t *a = (bench_arg_t *)p;
+    timer_req_t *reqs = (timer_req_t *)malloc(a->batch * sizeof(timer_req_t));
+    uint64_t t0;
+    int i, j;
+
+    pthread_barrier_wait(a->barrier);
+    t0 = now_ns();
+    for (i = 0; i < PER_THREAD; i += a->batch) {
+        if (a->batch == 1) {
+            a->seed ^= a->seed << 13; a->seed ^= a->seed >> 17; a->seed ^= a->seed << 5;
+            a->nodes[i] = tw_timer_add(a->T, 60000 + a->seed % 3600000, handler, 0);
+            continue;
+        }
+        for (j = 0; j < a->batch; j++) {
+            a->seed ^= a->seed << 13; a->seed ^= a->seed >> 17; a->seed ^= a->seed << 5;
+            reqs[j].time = 60000 + a->seed % 3600000;  // 1 分钟到 1 小时，不会在测试期间到期
+            reqs[j].callback = handler;
+            reqs[j].id = 0;
+        }
+        tw_timer_add_batch(a->T, reqs, a->batch, &a->nodes[i]);
+    }
+    a->add_ns = now_ns() - t0;
+
+    pthread_barrier_wait(a->barrier);  // 主线程在两次 barrier 之间把提交队列放入时间轮
+    pthread_barrier_wait(a->barrier);
+    t0 = now_ns();
+    for (i = 0; i < PER_THREAD; i += a->batch) {
+        if (a->batch == 1)
+            tw_timer_del(a->T, a->nodes[i]);
+        else
+            tw_timer_del_batch(a->T, &a->nodes[i], a->batch);
+    }
+    a->del_ns = now_ns() - t0;
+
+    free(reqs);
+    return NULL;
+}
+
+static void run(int nthreads, int batch) {
+    pthread_t tids[16], tick;
+    bench_arg_t args[16];
+    pthread_barrier_t barrier;
+    uint64_t add = 0, del = 0;
+    int i;
+
+    s_timer_t *T = tw_timer_create(0);
+    ticking = T;
+    ticking_stop = 0;
+    pthread_create(&tick, NULL, ticker, NULL);
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        args[i].T = T;
+        args[i].batch = batch;
+        args[i].seed = 2463534242u + i;
+        args[i].nodes = (timer_node_t **)malloc(PER_THREAD * sizeof(timer_node_t *));
+        args[i].barrier = &barrier;
+        pthread_create(&tids[i], NULL, worker, &args[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    tw_timer_nearest(T);  // 所有节点放入时间轮，删除时走立即摘除的路径
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        add += args[i].add_ns;
+        del += args[i].del_ns;
+        free(args[i].nodes);
+    }
+    ticking_stop = 1;
+    pthread_join(tick, NULL);
+    pthread_barrier_destroy(&barrier);
+    tw_timer_destroy(T);
+
+    printf("threads=%-2d batch=%-5d add=%6.1fns/timer del=%6.1fns/timer\n",
+        nthreads, batch, (double)add / ((uint64_t)nthreads * PER_THREAD), (double)del / ((uint64_t)nthreads * PER_THREAD));
+}
+
+int main() {
+    static const int threads[] = {1, 2, 4, 8};
+    static const int batches[] = {1, 8, 64, 512, 4000};  // 都能整除 PER_THREAD
+    unsigned t, b;
+
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+            run(threads[t], batches[b]);
+    return 0;
+}
+
+// gcc -O2 timewheel_bench.c timewheel.c -lpthread -o tw_bench
+// gcc -O2 -DTIMER_USE_POOL timewheel_bench.c timewheel.c mempool.c -lpthread -o tw_bench_pool
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timewheel.h"
+
+/*
+ * 微秒级定时器的实际执行时间与期望时间之差
+ *   始终保持 OUTSTANDING 个 MIN_US 到 MAX_US 微秒的一次性定时器，回调记录推迟了多少微秒并补一个新的，
+ *   推进线程忙等调用 tw_timer_expire，排除休眠唤醒的误差，只比较时间轮本身的精度
+ *   ms：tw_timer_add_us 全部向上取整到毫秒；hres：延迟小于 THRESHOLD_US 的放入高精度时间轮
+ */
+#define OUTSTANDING 1000
+#define MIN_US 50
+#define MAX_US 5000
+#define THRESHOLD_US 5000
+#define RUN_NS 2000000000ull
+#define HIST 20000           // 推迟时间的直方图，1 微秒一格
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static s_timer_t *T;
+static uint64_t target[OUTSTANDING];  // 每个槽位（node->id）当前定时器的期望执行时间
+static uint32_t hist[HIST + 1];
+static uint64_t fired, early, late_total, late_max;
+static uint32_t seed = 2463534242u;
+
+static void handler(timer_node_t *node);
+
+static void arm(int id) {
+    int us;
+    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+    us = MIN_US + seed % (MAX_US - MIN_US);
+    target[id] = now_ns() + (uint64_t)us * 1000;
+    tw_timer_add_us(T, us, handler, id);
+}
+
+static void handler(timer_node_t *node) {
+    uint64_t now = now_ns(), late;
+    if (now < target[node->id]) {
+        early++;
+    } else {
+        late = (now - target[node->id]) / 1000;
+        late_total += late;
+        if (late > late_max)
+            late_max = late;
+        hist[late > HIST ? HIST : late]++;
+    }
+    fired++;
+    arm(node->id);
+}
+
+static uint64_t percentile(double p) {
+    uint64_t want = (uint64_t)(fired * p), sum = 0;
+    int i;
+    for (i = 0; i <= HIST; i++) {
+        sum += hist[i];
+        if (sum > want)
+            return i;
+    }
+    return HIST;
+}
+
+static void run(const char *name, int hires) {
+    uint64_t begin;
+    int i;
+
+    T = tw_timer_create(TIMER_UNLOCKED);
+    if (hires && tw_timer_set_hires(T, THRESHOLD_US) != 0) {
+        printf("tw_timer_set_hires failed\n");
+        exit(1);
+    }
+    memset(hist, 0, sizeof(hist));
+    fired = early = late_total = late_max = 0;
+    for (i = 0; i < OUTSTANDING; i++)
+        arm(i);
+    begin = now_ns();
+    while (now_ns() - begin < RUN_NS)
+        tw_timer_expire(T);
+    printf("%-5s fired=%-8lu early=%lu late(us): avg=%6.1f p50=%-5lu p99=%-5lu p99.9=%-5lu max=%lu\n",
+        name, fired, early, (double)late_total / fired, percentile(0.5), percentile(0.99), percentile(0.999), late_max);
+    tw_timer_destroy(T);
+}
+
+int main() {
+    run("ms", 0);
+    run("hres", 1);
+    return 0;
+}
+
+// gcc -O2 timewheel_hres_bench.c timewheel.c -lpthread -o tw_hres_bench
+// gcc -O2 -DTIMER_USE_POOL timewheel_hres_bench.c timewheel.c mempool.c -lpthread -o tw_hres_bench_pool
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "timewheel.h"
+
+/*
+ * 单个时间轮与分片时间轮的 add / del 吞吐量随线程数的变化
+ *   nthreads 个线程各自添加 PER_THREAD 个定时器后立即逐个删除，另有一个线程不停推进
+ *   single：所有线程共用一个 s_timer_t；sharded：每个线程一个分片（threadid 即线程下标），
+ *   推进线程用 tw_sharded_expire 统一推进所有分片
+ *   删除前先 nearest 一次，把提交队列中的节点放入时间轮，删除走立即摘除的路径
+ */
+#define PER_THREAD 500000
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void handler(timer_node_t *node) {
+    (void)node;
+}
+
+typedef struct bench_arg {
+    s_timer_t *T;       // single 模式
+    tw_sharded_t *S;    // sharded 模式
+    int id;
+    timer_node_t **nodes;
+    pthread_barrier_t *barrier;
+} bench_arg_t;
+
+static volatile int ticking_stop;
+
+static void * ticker(void *p) {
+    bench_arg_t *a = (bench_arg_t *)p;
+    while (!ticking_stop) {
+        if (a->S)
+            tw_sharded_expire(a->S);
+        else
+            tw_timer_expire(a->T);
+    }
+    return NULL;
+}
+
+static void * worker(void *p) {
+    bench_arg_t *a = (bench_arg_t *)p;
+    uint32_t seed = 2463534242u + a->id;
+    int i;
+
+    pthread_barrier_wait(a->barrier);
+    for (i = 0; i < PER_THREAD; i++) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        if (a->S)
+            a->nodes[i] = tw_sharded_add(a->S, 60000 + seed % 3600000, handler, a->id);
+        else
+            a->nodes[i] = tw_timer_add(a->T, 60000 + seed % 3600000, handler, a->id);
+    }
+    if (a->S)
+        tw_timer_nearest(tw_sharded_shard(a->S, a->id));
+    else
+        tw_timer_nearest(a->T);
+    for (i = 0; i < PER_THREAD; i++) {
+        if (a->S)
+            tw_sharded_del(a->S, a->nodes[i]);
+        else
+            tw_timer_del(a->T, a->nodes[i]);
+    }
+    return NULL;
+}
+
+static double run(int nthreads, int sharded) {
+    pthread_t tids[16], tick;
+    bench_arg_t args[16], targ;
+    pthread_barrier_t barrier;
+    uint64_t t0, t1;
+    int i;
+
+    targ.T = sharded ? NULL : tw_timer_create(0);
+    targ.S = sharded ? tw_sharded_create(nthreads, 0) : NULL;
+    ticking_stop = 0;
+    pthread_create(&tick, NULL, ticker, &targ);
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        args[i] = targ;
+        args[i].id = i;
+        args[i].nodes = (timer_node_t **)malloc(PER_THREAD * sizeof(timer_node_t *));
+        args[i].barrier = &barrier;
+        pthread_create(&tids[i], NULL, worker, &args[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    t0 = now_ns();
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    t1 = now_ns();
+    ticking_stop = 1;
+    pthread_join(tick, NULL);
+    pthread_barrier_destroy(&barrier);
+    for (i = 0; i < nthreads; i++)
+        free(args[i].nodes);
+    if (sharded)
+        tw_sharded_destroy(targ.S);
+    else
+        tw_timer_destroy(targ.T);
+
+    return 2.0 * nthreads * PER_THREAD / ((t1 - t0) / 1e3);  // 每微秒完成的 add + del 次数，即 Mops/s
+}
+
+int main() {
+    static const int threads[] = {1, 2, 4, 8, 16};
+    unsigned t;
+
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        double single = run(threads[t], 0);
+        double sharded = run(threads[t], 1);
+        printf("threads=%-2d single=%6.2f Mops/s sharded=%6.2f Mops/s\n", threads[t], single, sharded);
+    }
+    return 0;
+}
+
+// gcc -O2 timewheel_shard_bench.c timewheel.c -lpthread -o tw_shard_bench
+// gcc -O2 -DTIMER_USE_POOL timewheel_shard_bench.c timewheel.c mempool.c -lpthread -o tw_shard_bench_pool
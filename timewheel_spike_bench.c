@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timewheel.h"
+
+/*
+ * 默认模式与 TIMER_NO_CASCADE 模式推进时的停顿
+ *   放入 N 个 1 分钟到 2 小时的定时器，然后逐个 tick 推进，记录每个 tick 的耗时
+ *   默认模式在 256、16384 ... 的整数倍 tick 上整批重新映射高层槽，单个 tick 的耗时会出现尖峰；
+ *   TIMER_NO_CASCADE 的每个 tick 只执行到期的节点，代价是执行时间最多推迟约 1/8
+ * 耗时分两类统计：没有节点到期的 tick 只有维护开销（重新映射），是纯粹的停顿；
+ *   有节点到期的 tick 按到期节点数平均。TIMER_NO_CASCADE 的高层槽粒度粗，大量节点在同一个 tick 到期，
+ *   这部分耗时是执行回调本身，两种模式总量相同
+ */
+#define N (2 * 1000 * 1000)
+#define MIN_DELAY 60000      // 1 分钟
+#define MAX_DELAY 7200000    // 2 小时
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t tick;          // 与时间轮内部时间同步推进，回调中用来计算推迟了多少
+static uint64_t fired, late_total;
+static uint32_t late_max;
+
+static void handler(timer_node_t *node) {
+    uint32_t late = tick - (uint32_t)node->id;  // id 中存放期望的超时 tick
+    fired++;
+    late_total += late;
+    if (late > late_max)
+        late_max = late;
+}
+
+static void run(const char *name, int flags) {
+    s_timer_t *T = tw_timer_create(flags | TIMER_UNLOCKED);
+    uint32_t seed = 2463534242u, d, i;
+    uint64_t t0, t1, begin, before, max_ns = 0, idle_max_ns = 0, over_100us = 0, fire_ticks = 0, fire_ns = 0, burst = 0;
+    timer_stats_t st;
+
+    tick = 0;
+    fired = late_total = late_max = 0;
+    for (i = 0; i < N; i++) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        d = MIN_DELAY + seed % (MAX_DELAY - MIN_DELAY);
+        tw_timer_add(T, d, handler, d);  // 内部时间从 0 开始，超时 tick 就是 d
+    }
+    timer_advance(T, 0);  // 放入时间轮，不计入推进耗时
+
+    begin = now_ns();
+    while (fired < N) {
+        before = fired;
+        t0 = now_ns();
+        tick++;
+        timer_advance(T, 1);
+        t1 = now_ns() - t0;
+        if (t1 > max_ns)
+            max_ns = t1;
+        if (fired == before) {  // 没有节点到期
+            if (t1 > idle_max_ns)
+                idle_max_ns = t1;
+            over_100us += t1 > 100000;
+        } else {
+            fire_ticks++;
+            fire_ns += t1;
+            if (fired - before > burst)
+                burst = fired - before;
+        }
+    }
+    tw_timer_stats(T, &st);
+    printf("%-10s total=%6.1fms cascaded=%-8lu idle ticks: max=%7.1fus >100us=%-4lu  firing ticks=%-7lu %5.1fns/timer max_burst=%-6lu max_tick=%7.1fus  late avg=%.0f max=%u\n",
+        name, (now_ns() - begin) / 1e6, st.cascaded, idle_max_ns / 1e3, over_100us,
+        fire_ticks, (double)fire_ns / N, burst, max_ns / 1e3, (double)late_total / N, late_max);
+    tw_timer_destroy(T);
+}
+
+int main() {
+    run("cascade", 0);
+    run("no-cascade", TIMER_NO_CASCADE);
+    return 0;
+}
+
+// gcc -O2 timewheel_spike_bench.c timewheel.c -lpthread -o tw_spike_bench
+// gcc -O2 -DTIMER_USE_POOL timewheel_spike_bench.c timewheel.c mempool.c -lpthread -o tw_spike_bench_pool
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+
+#include "timewheel.hpp"
+
+extern "C" {
+#include "timewheel.h"
+}
+
+using namespace std;
+
+/*
+ * 不同几何参数的 TimeWheel 与 timewheel.c 的对比
+ *   每种配置放入 N 个定时器（超时为 [lo, hi) 内的随机 tick 数），删除其中 1/8，再推进到全部到期
+ *   分别统计 add、del 和推进（含回调）平均到每个定时器的耗时
+ *   tick 数相同而 tick 长度不同：推进走的是模拟时间，只比较不同几何参数的代码本身
+ */
+#define N (1000 * 1000)
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t fired;
+
+template <class Wheel>
+static void Run(const char *name, uint64_t lo, uint64_t hi) {
+    Wheel *wheel = new Wheel;
+    vector<typename Wheel::Node *> nodes(N);
+    uint32_t seed = 2463534242u;
+    uint64_t t0, add, del, adv, i;
+
+    fired = 0;
+    t0 = now_ns();
+    for (i = 0; i < N; i++) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        nodes[i] = wheel->AddTimerTicks(lo + seed % (hi - lo), [](typename Wheel::Node &) { fired++; });
+    }
+    add = now_ns() - t0;
+    t0 = now_ns();
+    for (i = 0; i < N; i += 8)
+        wheel->DelTimer(nodes[i]);
+    del = now_ns() - t0;
+    t0 = now_ns();
+    wheel->Advance(hi);
+    adv = now_ns() - t0;
+
+    printf("%-34s ticks=[%llu,%llu) add=%5.1fns del=%5.1fns advance=%6.1fns/timer fired=%llu\n", name,
+        (unsigned long long)lo, (unsigned long long)hi, (double)add / N, (double)del / (N / 8),
+        (double)adv / N, (unsigned long long)fired);
+    delete wheel;
+}
+
+static void handler(timer_node_t *node) {
+    (void)node;
+    fired++;
+}
+
+static void RunC(uint64_t lo, uint64_t hi) {  // timewheel.c：1ms tick，near 8 位，4 层 6 位
+    s_timer_t *T = tw_timer_create(TIMER_UNLOCKED);
+    vector<timer_node_t *> nodes(N);
+    uint32_t seed = 2463534242u;
+    uint64_t t0, add, del, adv, i;
+
+    fired = 0;
+    t0 = now_ns();
+    for (i = 0; i < N; i++) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        nodes[i] = tw_timer_add(T, int(lo + seed % (hi - lo)), handler, 0);
+    }
+    timer_advance(T, 0);  // 把提交队列中的节点放入时间轮
+    add = now_ns() - t0;
+    t0 = now_ns();
+    for (i = 0; i < N; i += 8)
+        tw_timer_del(T, nodes[i]);
+    del = now_ns() - t0;
+    t0 = now_ns();
+    timer_advance(T, hi);
+    adv = now_ns() - t0;
+
+    printf("%-34s ticks=[%llu,%llu) add=%5.1fns del=%5.1fns advance=%6.1fns/timer fired=%llu\n", "timewheel.c",
+        (unsigned long long)lo, (unsigned long long)hi, (double)add / N, (double)del / (N / 8),
+        (double)adv / N, (unsigned long long)fired);
+    tw_timer_destroy(T);
+}
+
+int main() {
+    // 与 timewheel.c 相同的负载：1 分钟到 1 小时（1ms tick）
+    RunC(60000, 3660000);
+    Run<TimeWheel<1000000, 8, 6, 4>>("TimeWheel<1ms, 8, 6, 4>", 60000, 3660000);
+    Run<TimeWheel<100000, 10, 6, 4>>("TimeWheel<100us, 10, 6, 4>", 60000, 3660000);
+    Run<TimeWheel<1000000000, 6, 6, 3>>("TimeWheel<1s, 6, 6, 3>", 60000, 3660000);
+
+    // 各自典型的负载
+    Run<TimeWheel<100000, 10, 6, 4>>("TimeWheel<100us, 10, 6, 4> 1ms~10s", 10, 100000);     // 撮合网关的订单超时
+    Run<TimeWheel<1000000000, 6, 6, 3>>("TimeWheel<1s, 6, 6, 3> 30min~24h", 1800, 86400);   // 会话过期
+    Run<TimeWheel<1000000000, 6, 3, 3>>("TimeWheel<1s, 6, 3, 3> 30min~24h", 1800, 86400);   // 超出 2^15 tick 的范围，最高层反复重新放入
+    return 0;
+}
+
+// gcc -O2 -c timewheel.c -o timewheel.o && g++ -O2 -std=c++17 timewheel_tpl_bench.cc timewheel.o -lpthread -o tw_tpl_bench
+// gcc -O2 -DTIMER_USE_POOL -c timewheel.c mempool.c && g++ -O2 -std=c++17 -DTIMER_USE_POOL timewheel_tpl_bench.cc timewheel.o mempool.o -lpthread -o tw_tpl_bench_pool